@@ -3,18 +3,291 @@
  *     This is just a toy. DO NOT use it in any production environment.
  *     It stream output all types of array, if the stream output for its
  *     element is defined.
+ *     For large arrays, vectors or spans, formatted(a, opts) writes numbers by
+ *     to_chars into a big buffer, which goes to the stream in one write when
+ *     it is full. Separators, precision, and printing only the first and last
+ *     k elements are set in opts. With opts.threads > 1, chunks of the array
+ *     are formatted by threads, and written in order.
+ *     nested(a, opts) writes a C array of any rank with brackets for each
+ *     rank, like [[1, 2], [3, 4]], in a single pass over its elements. With
+ *     opts.rows, each innermost row goes to a line of its own.
  *     This requires C++20 to compile.
  */
 #include <iostream>
 #include <type_traits>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <utility>
+#include <chrono>
 using namespace std;
 
-template <typename T, size_t n> 
+struct array_format{
+    const char *sep = ", ";
+    int precision = -1;         // digits of floating points, -1 for the shortest
+                                // that reads back the same value
+    size_t edge = 0;            // if > 0, only the first and last edge elements
+    const char *ellipsis = "...";
+    unsigned threads = 1;       // 0 for all cores
+    bool rows = false;          // nested(): one innermost row per line
+};
+
+// Chars go to s, and s goes to o when it is full. Without o, s grows.
+struct format_buffer{
+    string &s;
+    ostream *o;
+    size_t n = 0;
+    char *room(size_t k){
+        if (n + k > s.size()){
+            if (o){
+                o->write(s.data(), n);
+                n = 0;
+            }
+            if (n + k > s.size())
+                s.resize(max(2 * s.size(), n + k));
+        }
+        return s.data() + n;
+    }
+    void fill(char c, size_t k){
+        memset(room(k), c, k);
+        n += k;
+    }
+    void put(string_view v){
+        memcpy(room(v.size()), v.data(), v.size());
+        n += v.size();
+    }
+    void flush(){
+        if (o)
+            o->write(s.data(), n);
+        n = 0;
+    }
+};
+
+// Numbers by to_chars, strings by memcpy, and others by their own <<
+template <typename T>
+void format_one(format_buffer &b, const T &v, const array_format &f, ostringstream &ss){
+    using U = remove_cvref_t<T>;
+    if constexpr (is_arithmetic_v<U> && !is_same_v<U, bool> && !is_same_v<U, char>){
+        const size_t k = 32 + max(f.precision, 0);
+        char *p = b.room(k);
+        to_chars_result r;
+        if constexpr (is_floating_point_v<U>)
+            r = f.precision < 0 ? to_chars(p, p + k, v)
+                : to_chars(p, p + k, v, chars_format::general, f.precision);
+        else
+            r = to_chars(p, p + k, v);
+        b.n += r.ptr - p;
+    }
+    else if constexpr (is_same_v<decay_t<U>, const char *> || is_same_v<decay_t<U>, char *>)
+        b.put(v);
+    else {
+        ss.str("");
+        ss << v;
+        b.put(ss.view());
+    }
+}
+
+// Elements [lo, hi), with a separator before each one but the first of all
+template <typename T>
+void format_range(format_buffer &b, span<const T> a, size_t lo, size_t hi,
+    const array_format &f, bool first){
+    ostringstream ss;
+    if constexpr (is_floating_point_v<T>)
+        ss.precision(f.precision < 0 ? 17 : f.precision);
+    const string_view sep(f.sep);
+    for (size_t i = lo; i < hi; i ++){
+        if (!first || i > lo)
+            b.put(sep);
+        format_one(b, a[i], f, ss);
+    }
+}
+
+// Threads take chunks k, k + t, k + 2t, ..., and the caller writes them in
+// order. A thread does not run more than 2t chunks ahead of the writer.
+template <typename T>
+void format_parallel(ostream &o, span<const T> a, const array_format &f,
+    unsigned t, bool first){
+    const size_t chunk = 1 << 16;
+    const size_t chunks = (a.size() + chunk - 1) / chunk;
+    t = max<size_t>(min<size_t>(t, chunks), 1);
+    vector<string> out(chunks);
+    vector<char> ready(chunks);
+    size_t written = 0;
+    mutex m;
+    condition_variable cv;
+    vector<thread> threads;
+    for (unsigned k = 0; k < t; k ++)
+        threads.emplace_back([&, k]{
+            for (size_t c = k; c < chunks; c += t){
+                {
+                    unique_lock<mutex> l(m);
+                    cv.wait(l, [&]{ return c < written + 2 * t; });
+                }
+                string s(chunk * 8, '\0');
+                format_buffer b{s, nullptr};
+                format_range(b, a, c * chunk, min(a.size(), (c + 1) * chunk),
+                    f, first && c == 0);
+                s.resize(b.n);
+                lock_guard<mutex> l(m);
+                out[c] = std::move(s);
+                ready[c] = 1;
+                cv.notify_all();
+            }
+        });
+    for (size_t c = 0; c < chunks; c ++){
+        string s;
+        {
+            unique_lock<mutex> l(m);
+            cv.wait(l, [&]{ return ready[c] != 0; });
+            s = std::move(out[c]);
+        }
+        o.write(s.data(), s.size());
+        lock_guard<mutex> l(m);
+        written = c + 1;
+        cv.notify_all();
+    }
+    for (auto &th: threads)
+        th.join();
+}
+
+template <typename T>
+void format_array(ostream &o, span<const T> a, const array_format &f = {}){
+    unsigned t = f.threads ? f.threads : max(thread::hardware_concurrency(), 1u);
+    const bool cut = f.edge && a.size() > 2 * f.edge;
+    auto part = [&](span<const T> p, bool first){
+        if (t > 1 && p.size() > (1 << 16)){
+            format_parallel(o, p, f, t, first);
+            return;
+        }
+        thread_local string s(1 << 20, '\0');
+        format_buffer b{s, &o};
+        format_range(b, p, 0, p.size(), f, first);
+        b.flush();
+    };
+    if (!cut){
+        part(a, true);
+        return;
+    }
+    part(a.first(f.edge), true);
+    o << f.sep << f.ellipsis;
+    part(a.last(f.edge), false);
+}
+
+template <typename T>
+struct formatted_t{
+    span<const T> a;
+    array_format f;
+};
+
+// cout << formatted(a, {.sep = " ", .edge = 3}); for arrays, vectors or spans
+template <typename R>
+auto formatted(const R &r, const array_format &f = {}){
+    span s(r);
+    return formatted_t<remove_cv_t<typename decltype(s)::element_type>>{s, f};
+}
+
+template <typename T>
+ostream &operator<< (ostream &o, const formatted_t<T> &a){
+    format_array(o, a.a, a.f);
+    return o;
+}
+
+// Brackets of all ranks are written in one pass over the elements. After a
+// row, the number of ranks that wrap tells how many brackets to close and
+// open again, so no recursion is needed.
+template <typename A> requires is_array_v<A>
+void format_nested(ostream &o, const A &a, const array_format &f = {}){
+    using T = remove_all_extents_t<A>;
+    constexpr size_t r = rank_v<A>;
+    constexpr auto ext = []<size_t... i>(index_sequence<i...>){
+        return array<size_t, r>{ extent_v<A, i>... };
+    }(make_index_sequence<r>{});
+    constexpr size_t cols = ext[r - 1];
+    constexpr size_t rows = sizeof(A) / sizeof(T) / cols;
+    const T *p = reinterpret_cast<const T *>(&a);
+    const string_view sep(f.sep);
+    const string_view row_sep = sep.substr(0, sep.find_last_not_of(" ") + 1);
+    array<size_t, r> idx{};
+    ostringstream ss;
+    if constexpr (is_floating_point_v<T>)
+        ss.precision(f.precision < 0 ? 17 : f.precision);
+    thread_local string s(1 << 20, '\0');
+    format_buffer b{s, &o};
+    b.fill('[', r);
+    for (size_t row = 0; row < rows; row ++, p += cols){
+        if (row){
+            size_t k = 1;
+            for (size_t d = r - 1; d -- > 0 && ++ idx[d] == ext[d]; k ++)
+                idx[d] = 0;
+            b.fill(']', k);
+            if (f.rows){
+                b.put(row_sep);
+                b.fill('\n', k);
+                b.fill(' ', r - k);
+            }
+            else
+                b.put(sep);
+            b.fill('[', k);
+        }
+        format_one(b, p[0], f, ss);
+        for (size_t j = 1; j < cols; j ++){
+            b.put(sep);
+            format_one(b, p[j], f, ss);
+        }
+    }
+    b.fill(']', r);
+    b.flush();
+}
+
+template <typename A>
+struct nested_t{
+    const A &a;
+    array_format f;
+};
+
+// cout << nested(m, {.rows = true}); for C arrays of any rank
+template <typename A> requires is_array_v<A>
+nested_t<A> nested(const A &a, const array_format &f = {}){
+    return {a, f};
+}
+
+template <typename A>
+ostream &operator<< (ostream &o, const nested_t<A> &a){
+    format_nested(o, a.a, a.f);
+    return o;
+}
+
+template <typename T>
+constexpr bool is_char_v = is_same_v<T, char> || is_same_v<T, signed char> ||
+    is_same_v<T, unsigned char> || is_same_v<T, wchar_t> || is_same_v<T, char8_t> ||
+    is_same_v<T, char16_t> || is_same_v<T, char32_t>;
+
+// Numbers and strings go through format_array while the stream has no flags,
+// width or locale that would change them. Floating points then take the
+// stream precision. All others are written one by one, as before.
+template <typename T, size_t n>
 ostream &operator<< (ostream &o, const T (&a)[n]) requires (
-    ! is_same <char, typename remove_cvref<T>::type>::value 
+    ! is_same <char, typename remove_cvref<T>::type>::value
 ) {
-    for (size_t i = 0; i < n; i ++)
-        o << a[i] << ", " + ((i == n - 1) << 1);
+    using U = remove_cv_t<T>;
+    constexpr bool fast = (is_arithmetic_v<U> && !is_same_v<U, bool> && !is_char_v<U>)
+        || is_same_v<decay_t<U>, const char *> || is_same_v<decay_t<U>, char *>;
+    const auto plain = ios_base::dec | ios_base::skipws | ios_base::unitbuf;
+    if (fast && (o.flags() & ~plain) == ios_base::fmtflags{} && (o.flags() & ios_base::dec)
+        && o.width() == 0 && o.getloc() == locale::classic())
+        format_array(o, span<const T>(a), {.precision = int(o.precision())});
+    else
+        for (size_t i = 0; i < n; i ++)
+            o << a[i] << ", " + ((i == n - 1) << 1);
     return o;
 }
 
@@ -22,11 +295,78 @@ ostream &operator<< (ostream &o, const T (&a)[n]) requires (
  * The output of the following program will be:
  * Data: [ 1, 2, 3, 4, 5 ]
  * Name: [ Alice, Bob, Charlie, David, Eve ]
+ * Squares: [ 0 1 4 ... 9409 9604 9801 ]
+ * Roots: [ 0, 1, 1.414, ..., 9.849, 9.899, 9.95 ]
+ * Cube: [[[0, 1, 2], [3, 4, 5]], [[6, 7, 8], [9, 10, 11]]]
+ * Matrix:
+ * [[0.5, 1, 1.5],
+ *  [2, 2.5, 3]]
+ * Run it with "bench" to time nested() against the recursive << on a big cube.
  */
-int main(){
+// Counts and drops the chars, so that only the formatting is timed
+struct count_buf: streambuf{
+    size_t n = 0;
+    int overflow(int c) override { n ++; return c; }
+    streamsize xsputn(const char *, streamsize k) override { n += k; return k; }
+};
+
+template <typename T>
+void bench_nested(){
+    constexpr size_t n = 160;
+    auto box = new T[1][n][n][n];
+    auto &cube = box[0];
+    for (size_t i = 0; i < n * n * n; i ++)
+        (&cube[0][0][0])[i] = T(i * 0.25);
+    auto timing = [](const char *name, auto &&f){
+        count_buf b;
+        ostream o(&b);
+        auto t0 = chrono::steady_clock::now();
+        f(o);
+        auto t1 = chrono::steady_clock::now();
+        cout << name << ": " << chrono::duration<double, milli>(t1 - t0).count()
+             << " ms, " << b.n << " chars" << endl;
+    };
+    const int precision = int(cout.precision());
+    cout << (is_integral_v<T> ? "int" : "double") << "[" << n << "][" << n << "][" << n << "]" << endl;
+    timing("<< per element", [&](ostream &o){
+        for (auto &plane: cube)
+            for (auto &row: plane)
+                for (size_t k = 0; k < n; k ++)
+                    o << row[k] << ", " + ((k == n - 1) << 1);
+    });
+    timing("recursive <<", [&](ostream &o){ o << cube; });
+    timing("nested()", [&](ostream &o){ o << nested(cube, {.precision = precision}); });
+    timing("nested() rows", [&](ostream &o){
+        o << nested(cube, {.precision = precision, .rows = true});
+    });
+    delete [] box;
+}
+
+int main(int argc, char *argv[]){
+    if (argc > 1 && string_view(argv[1]) == "bench"){
+        bench_nested<int>();
+        bench_nested<double>();
+        return 0;
+    }
     int data[] = { 1, 2, 3, 4, 5 };
     const char *strs[] = { "Alice", "Bob", "Charlie", "David", "Eve" };
     cout << "Data: [ " << data << " ]" << endl;
     cout << "Name: [ " << strs << " ]" << endl;
+    vector<int> squares(100);
+    vector<double> roots(100);
+    for (int i = 0; i < 100; i ++){
+        squares[i] = i * i;
+        roots[i] = sqrt(i);
+    }
+    cout << "Squares: [ " << formatted(squares, {.sep = " ", .edge = 3}) << " ]" << endl;
+    cout << "Roots: [ " << formatted(roots, {.precision = 4, .edge = 3}) << " ]" << endl;
+    int cube[2][2][3];
+    double matrix[2][3];
+    for (int i = 0; i < 12; i ++)
+        (&cube[0][0][0])[i] = i;
+    for (int i = 0; i < 6; i ++)
+        (&matrix[0][0])[i] = (i + 1) * 0.5;
+    cout << "Cube: " << nested(cube) << endl;
+    cout << "Matrix:" << endl << nested(matrix, {.rows = true}) << endl;
     return 0;
 }
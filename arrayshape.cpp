@@ -5,43 +5,414 @@
  *     Shape of an array is a size_t array, containing extent of all dimensions. See below
  *     example for details. This is only a toy example or a proof of concept, not for using
  *     in a production environment.
+ *     The shape is a plain constexpr value. shape_of<T> gives it without an object.
+ *     array_view(a) looks at the elements of a through extents and strides. Its slices,
+ *     transposes and sub-views are views of the same memory, with other strides.
+ *     for_tiles and for_each_tiled walk an index space tile by tile, parallel_tiles and
+ *     parallel_for_each share rows of tiles among threads, and copy_view copies between
+ *     views of any layouts, cutting them in halves until blocks fit in the cache.
  */
 
 #include <iostream>
 #include <type_traits>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <string>
 using namespace std;
 
+template <size_t R>
 struct array_shape{
+    constexpr array_shape() = default;
+    template <typename... E>
+    constexpr array_shape(E... e)
+        requires (sizeof...(E) == R && (is_integral<E>::value && ...)): s{ size_t(e)... } {}
     template <typename T>
-    array_shape(T &a)
-        requires (is_array<T>::value): n(rank<T>::value), s(new size_t[n]{}) {
+    constexpr array_shape(T &)
+        requires (is_array<T>::value && rank<T>::value == R) {
         init<T>();
     }
-    ~array_shape() {
-        if (s) {
-            delete [] s;
-            s = 0;
-        }
-    }
     template <typename T, size_t m = rank<T>::value>
-    void init() {
+    constexpr void init() {
         if constexpr (m > 0) {
             s[m - 1] = extent<T, m - 1>::value;
             init<T, m - 1>();
         }
     }
-    const size_t n;
-    size_t *s;
+    constexpr size_t size() const {
+        size_t k = 1;
+        for (size_t i = 0; i < n; i ++)
+            k *= s[i];
+        return k;
+    }
+    static constexpr size_t n = R;
+    size_t s[R] = {};
 };
 
-ostream &operator<< (ostream &os, const array_shape &as){
+template <typename T>
+array_shape(T &) -> array_shape<rank<T>::value>;
+
+template <typename T> requires (is_array<T>::value)
+constexpr array_shape<rank<T>::value> shape_of = []{
+    array_shape<rank<T>::value> r;
+    r.template init<T>();
+    return r;
+}();
+
+template <size_t R>
+ostream &operator<< (ostream &os, const array_shape<R> &as){
     for (size_t i = 0; i < as.n; i ++)
         os << as.s[i] << ", " + (i == as.n - 1) * 2;
     return os;
 }
 
-int main() {
+// Address of the first element of an array of any rank
+template <typename A>
+constexpr auto *array_data(A &a) {
+    if constexpr (is_array<A>::value)
+        return array_data(a[0]);
+    else
+        return &a;
+}
+
+// Element (i, j, k, ...) is at p[i * stride[0] + j * stride[1] + ...]. A Dense
+// view knows at compile time that its last stride is 1, so loops over rows can be
+// vectorized as on the raw array. Views that may lose it are not Dense.
+template <typename T, size_t R, bool Dense = true>
+struct array_view{
+    constexpr array_view(T *data, const array_shape<R> &sh): p(data), shape(sh) {
+        ptrdiff_t k = 1;
+        for (size_t d = R; d -- > 0; ) {
+            stride[d] = k;
+            k *= shape.s[d];
+        }
+    }
+    template <typename A>
+    constexpr array_view(A &a)
+        requires (is_array<A>::value && rank<A>::value == R):
+        array_view(array_data(a), array_shape<R>(a)) {}
+    template <bool D>
+    constexpr array_view(const array_view<T, R, D> &v) requires (D && !Dense):
+        p(v.p), shape(v.shape) {
+        for (size_t d = 0; d < R; d ++)
+            stride[d] = v.stride[d];
+    }
+    constexpr ptrdiff_t step(size_t d) const {
+        return Dense && d == R - 1 ? 1 : stride[d];
+    }
+    // The row is found first, so that g++ sees a unit stride walk along it
+    template <typename... I>
+    constexpr T &operator()(I... i) const requires (sizeof...(I) == R) {
+        const ptrdiff_t at[] = { ptrdiff_t(i)... };
+        ptrdiff_t k = 0;
+        for (size_t d = 0; d + 1 < R; d ++)
+            k += at[d] * stride[d];
+        return (p + k)[at[R - 1] * step(R - 1)];
+    }
+    constexpr decltype(auto) operator[](size_t i) const {
+        if constexpr (R == 1)
+            return p[i * step(0)];
+        else
+            return sub<0>(i);
+    }
+    // The view with index i fixed on dimension D
+    template <size_t D>
+    constexpr auto sub(size_t i) const requires (R > 1 && D < R) {
+        array_view<T, R - 1, Dense && D != R - 1> v(p + i * stride[D], {});
+        for (size_t d = 0, k = 0; d < R; d ++)
+            if (d != D) {
+                v.shape.s[k] = shape.s[d];
+                v.stride[k ++] = stride[d];
+            }
+        return v;
+    }
+    // Indices first, first + 1, ... below last on dimension D
+    template <size_t D>
+    constexpr array_view slice(size_t first, size_t last) const requires (D < R) {
+        array_view v = *this;
+        v.p += first * stride[D];
+        v.shape.s[D] = last > first ? last - first : 0;
+        return v;
+    }
+    // Indices first, first + step, ... below last on dimension D
+    template <size_t D>
+    constexpr auto slice(size_t first, size_t last, size_t step) const requires (D < R) {
+        array_view<T, R, Dense && D != R - 1> v = *this;
+        v.p += first * stride[D];
+        v.shape.s[D] = last > first ? (last - first + step - 1) / step : 0;
+        v.stride[D] *= step;
+        return v;
+    }
+    // Dimension d of the result is dimension order[d] of this
+    constexpr array_view<T, R, R == 1 && Dense> permute(const size_t (&order)[R]) const {
+        array_view<T, R, R == 1 && Dense> v = *this;
+        for (size_t d = 0; d < R; d ++) {
+            v.shape.s[d] = shape.s[order[d]];
+            v.stride[d] = stride[order[d]];
+        }
+        return v;
+    }
+    constexpr array_view<T, R, R == 1 && Dense> transpose() const {
+        array_view<T, R, R == 1 && Dense> v = *this;
+        for (size_t d = 0; d < R; d ++) {
+            v.shape.s[d] = shape.s[R - 1 - d];
+            v.stride[d] = stride[R - 1 - d];
+        }
+        return v;
+    }
+    // The box of indices [lo, hi)
+    constexpr array_view box(const size_t (&lo)[R], const size_t (&hi)[R]) const {
+        array_view v = *this;
+        for (size_t d = 0; d < R; d ++) {
+            v.p += lo[d] * stride[d];
+            v.shape.s[d] = hi[d] - lo[d];
+        }
+        return v;
+    }
+    constexpr size_t extent(size_t d) const { return shape.s[d]; }
+    constexpr size_t size() const { return shape.size(); }
+    constexpr bool contiguous() const {
+        ptrdiff_t k = 1;
+        for (size_t d = R; d -- > 0; k *= shape.s[d])
+            if (shape.s[d] > 1 && step(d) != k)
+                return false;
+        return true;
+    }
+    static constexpr size_t rank = R;
+    T *p;
+    array_shape<R> shape;
+    ptrdiff_t stride[R] = {};
+};
+
+template <typename A> requires (is_array<A>::value)
+array_view(A &) -> array_view<remove_all_extents_t<A>, rank<A>::value>;
+
+template <typename T, size_t R, bool D>
+ostream &operator<< (ostream &os, const array_view<T, R, D> &v){
+    os << '[';
+    for (size_t i = 0; i < v.extent(0); i ++)
+        os << v[i] << ", " + (i == v.extent(0) - 1) * 2;
+    return os << ']';
+}
+
+// Calls f(lo, hi) for each tile [lo, hi) of the box [first, last), with tiles
+// in row-major order. Tiles on the far edges may be smaller.
+template <size_t R, typename F>
+void for_tiles(const size_t (&first)[R], const size_t (&last)[R], const size_t (&tile)[R], F &&f) {
+    size_t lo[R], hi[R];
+    auto next = [&](auto &self, size_t d) -> void {
+        for (size_t i = first[d]; i < last[d]; i += tile[d]) {
+            lo[d] = i;
+            hi[d] = min(i + tile[d], last[d]);
+            if (d + 1 < R)
+                self(self, d + 1);
+            else
+                f(lo, hi);
+        }
+    };
+    next(next, 0);
+}
+
+template <size_t R, typename F>
+void for_tiles(const array_shape<R> &sh, const size_t (&tile)[R], F &&f) {
+    const size_t first[R] = {};
+    for_tiles(first, sh.s, tile, f);
+}
+
+// Calls f(i, j, ...) for each index in the box [lo, hi), the last one fastest
+template <size_t D = 0, size_t R, typename F, typename... I>
+void for_box(const size_t (&lo)[R], const size_t (&hi)[R], F &f, I... i) {
+    if constexpr (D == R)
+        f(i...);
+    else
+        for (size_t k = lo[D]; k < hi[D]; k ++)
+            for_box<D + 1>(lo, hi, f, i..., k);
+}
+
+template <size_t R, typename F>
+void for_each_tiled(const array_shape<R> &sh, const size_t (&tile)[R], F &&f) {
+    for_tiles(sh, tile, [&](auto &lo, auto &hi) { for_box(lo, hi, f); });
+}
+
+// Like for_tiles, but rows of tiles along dimension 0 are taken by threads,
+// so f must be safe to call at the same time on different tiles.
+template <size_t R, typename F>
+void parallel_tiles(const array_shape<R> &sh, const size_t (&tile)[R], F &&f,
+    unsigned threads = 0) {
+    if (!threads)
+        threads = max(thread::hardware_concurrency(), 1u);
+    const size_t rows = (sh.s[0] + tile[0] - 1) / tile[0];
+    atomic<size_t> next{0};
+    auto work = [&] {
+        size_t first[R] = {}, last[R];
+        copy(begin(sh.s), end(sh.s), last);
+        for (size_t t; (t = next ++) < rows; ) {
+            first[0] = t * tile[0];
+            last[0] = min(first[0] + tile[0], sh.s[0]);
+            for_tiles(first, last, tile, f);
+        }
+    };
+    vector<thread> pool;
+    for (unsigned k = 1; k < threads && k < rows; k ++)
+        pool.emplace_back(work);
+    work();
+    for (auto &t: pool)
+        t.join();
+}
+
+template <size_t R, typename F>
+void parallel_for_each(const array_shape<R> &sh, const size_t (&tile)[R], F &&f,
+    unsigned threads = 0) {
+    parallel_tiles(sh, tile, [&](auto &lo, auto &hi) { for_box(lo, hi, f); }, threads);
+}
+
+template <size_t D = 0, typename T, typename U, size_t R, bool A, bool B>
+void copy_rows(T *d, const U *s, const array_view<T, R, A> &dv, const array_view<U, R, B> &sv) {
+    const size_t n = dv.extent(D);
+    if constexpr (D + 1 == R) {
+        const ptrdiff_t a = dv.step(D), b = sv.step(D);
+        if (a == 1 && b == 1)
+            copy(s, s + n, d);
+        else
+            for (size_t k = 0; k < n; k ++)
+                d[k * a] = s[k * b];
+    }
+    else
+        for (size_t i = 0; i < n; i ++)
+            copy_rows<D + 1>(d + i * dv.stride[D], s + i * sv.stride[D], dv, sv);
+}
+
+// Copies sv to dv, which have the same extents but may have any strides, like
+// copy_view(b, a.transpose()). The longest dimension is cut in halves until a
+// block is small enough for L1, so both layouts are walked by cache lines
+// without knowing the cache size.
+template <typename T, typename U, size_t R, bool A, bool B>
+void copy_view(array_view<T, R, A> dv, array_view<U, R, B> sv) {
+    if (dv.size() <= 1024) {
+        copy_rows(dv.p, sv.p, dv, sv);
+        return;
+    }
+    size_t d = 0;
+    for (size_t k = 1; k < R; k ++)
+        if (dv.extent(k) > dv.extent(d))
+            d = k;
+    const size_t h = dv.extent(d) / 2;
+    auto dw = dv;
+    auto sw = sv;
+    dv.shape.s[d] = sv.shape.s[d] = h;
+    dw.p += h * dw.stride[d];
+    sw.p += h * sw.stride[d];
+    dw.shape.s[d] -= h;
+    sw.shape.s[d] -= h;
+    copy_view(dv, sv);
+    copy_view(dw, sw);
+}
+
+// The same, with slabs along dimension 0 copied by threads
+template <typename T, typename U, size_t R, bool A, bool B>
+void copy_view(array_view<T, R, A> dv, array_view<U, R, B> sv, unsigned threads) {
+    if (!threads)
+        threads = max(thread::hardware_concurrency(), 1u);
+    size_t tile[R];
+    copy(begin(dv.shape.s), end(dv.shape.s), tile);
+    tile[0] = max<size_t>((tile[0] + 8 * threads - 1) / (8 * threads), 1);
+    parallel_tiles(dv.shape, tile, [&](auto &lo, auto &hi) {
+        copy_view(dv.box(lo, hi), sv.box(lo, hi));
+    }, threads);
+}
+
+// Run the program with "bench [n2] [n3]" to time these against nested loops on
+// an n2 x n2 and an n3 x n3 x n3 float array. The defaults are larger than most
+// last level caches.
+void bench(size_t n2, size_t n3) {
+    auto timing = [](const char *name, auto &&f, const vector<float> &b, const vector<float> &ref) {
+        auto t0 = chrono::steady_clock::now();
+        f();
+        auto t1 = chrono::steady_clock::now();
+        cout << "  " << name << ": " << chrono::duration<double, milli>(t1 - t0).count() << " ms"
+             << (ref.empty() || b == ref ? "" : " WRONG") << endl;
+    };
+    {
+        vector<float> x(n2 * n2), y(n2 * n2), ref;
+        for (size_t i = 0; i < x.size(); i ++)
+            x[i] = float(i);
+        array_view<float, 2> a(x.data(), { n2, n2 }), b(y.data(), { n2, n2 });
+        cout << "transpose of float[" << n2 << "][" << n2 << "]" << endl;
+        timing("nested loops", [&] {
+            for (size_t i = 0; i < n2; i ++)
+                for (size_t j = 0; j < n2; j ++)
+                    y[i * n2 + j] = x[j * n2 + i];
+        }, y, ref);
+        ref = y;
+        timing("for_each_tiled 64 x 64", [&] {
+            for_each_tiled(b.shape, { 64, 64 }, [&](size_t i, size_t j) { b(i, j) = a(j, i); });
+        }, y, ref);
+        timing("copy_view", [&] { copy_view(b, a.transpose()); }, y, ref);
+        timing("copy_view on threads", [&] { copy_view(b, a.transpose(), 0); }, y, ref);
+    }
+    {
+        vector<float> x(n3 * n3 * n3), y(n3 * n3 * n3), ref;
+        for (size_t i = 0; i < x.size(); i ++)
+            x[i] = float(i);
+        array_view<float, 3> a(x.data(), { n3, n3, n3 }), b(y.data(), { n3, n3, n3 });
+        cout << "b(i, j, k) = a(k, j, i) of float[" << n3 << "][" << n3 << "][" << n3 << "]" << endl;
+        timing("nested loops", [&] {
+            for (size_t i = 0; i < n3; i ++)
+                for (size_t j = 0; j < n3; j ++)
+                    for (size_t k = 0; k < n3; k ++)
+                        y[(i * n3 + j) * n3 + k] = x[(k * n3 + j) * n3 + i];
+        }, y, ref);
+        ref = y;
+        timing("for_each_tiled 16 x 16 x 16", [&] {
+            for_each_tiled(b.shape, { 16, 16, 16 },
+                [&](size_t i, size_t j, size_t k) { b(i, j, k) = a(k, j, i); });
+        }, y, ref);
+        timing("parallel_for_each", [&] {
+            parallel_for_each(b.shape, { 16, 16, 16 },
+                [&](size_t i, size_t j, size_t k) { b(i, j, k) = a(k, j, i); });
+        }, y, ref);
+        timing("copy_view", [&] { copy_view(b, a.transpose()); }, y, ref);
+        timing("copy_view on threads", [&] { copy_view(b, a.transpose(), 0); }, y, ref);
+    }
+}
+
+/*
+ * The output of the following program will be:
+ * 9, 8, 7
+ * 1, 2, 3 -> 123 123
+ * [[0, 10, 20], [1, 11, 21]]
+ * [[10, 11], [20, 21]]
+ * 8, 4
+ * [[0, 4, 8], [1, 5, 9], [2, 6, 10], [3, 7, 11]]
+ * 0-2 0-3, 0-2 3-4, 2-3 0-3, 2-3 3-4
+ */
+int main(int argc, char *argv[]) {
+    if (argc > 1 && string(argv[1]) == "bench") {
+        bench(argc > 2 ? stoul(argv[2]) : 10240, argc > 3 ? stoul(argv[3]) : 480);
+        return 0;
+    }
     int a[9][8][7] = {};
     cout << array_shape(a) << endl; // output is 9, 8, 7
+    static_assert(shape_of<int[9][8][7]>.s[1] == 8 && shape_of<decltype(a)>.size() == 504);
+    array_view v(a);
+    a[1][2][3] = 123;
+    cout << "1, 2, 3 -> " << v(1, 2, 3) << ' ' << v.sub<2>(3)(1, 2) << endl;
+    int m[3][2] = { { 0, 1 }, { 10, 11 }, { 20, 21 } };
+    array_view w(m);
+    cout << w.transpose() << endl;
+    cout << w.slice<0>(1, 3) << endl;
+    cout << v[0].slice<1>(0, 7, 2).shape << endl;
+    int x[3][4], y[4][3];
+    for (int i = 0; i < 12; i ++)
+        (&x[0][0])[i] = i;
+    copy_view(array_view(y), array_view(x).transpose());
+    cout << array_view(y) << endl;
+    for_tiles(array_shape(x), { 2, 3 }, [](auto &lo, auto &hi) {
+        cout << ", " + (lo[0] + lo[1] == 0) * 2 << lo[0] << '-' << hi[0] << ' ' << lo[1] << '-' << hi[1];
+    });
+    cout << endl;
     return 0;
 }
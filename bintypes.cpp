@@ -27,19 +27,75 @@
  *    Common arithmetic operators, like +, -, *, and /, are automatically defined
  *    for the wrapped type.
  *
- *    We need C++20 to compile.
+ *    Arrays of wrapped values are seqable_array<T>, which can also be a view of
+ *    an array of T that is already there, without copying it. Arithmetic, 
+ *    comparison and bitwise operators work on whole arrays, element by element,
+ *    or with a single value on one side, in loops that compilers vectorize. 
+ *    Each element is still a seqable, so a[i].bytes and a[i].ieee754() are there.
+ *
+ *    For large buffers, arrays or files, use dump(). Bytes are turned into bits
+ *    or hex digits by lookup tables, and written to the stream in big blocks.
+ *    Bytes can be grouped, with bits of each byte in MSB or LSB first order,
+ *    and lines can have offsets like a hex editor. dump_stream() does the same
+ *    chunk by chunk for an istream, so files of any size can be dumped.
+ *
+ *    For arrays of floating points, ieee754_split() puts signs, exponents and
+ *    mantissas into separate columns, and ieee754_stats() counts exponents,
+ *    zeros, subnormals, Infs and NaNs in one pass. It tells how many values
+ *    would overflow or underflow in a smaller format, before we move to it.
+ *
+ *    The smaller formats are there too, binary16 (half_t), bfloat16, and two
+ *    FP8 formats, E4M3 and E5M2. fp_encode<D>() and fp_decode<T, D>() convert
+ *    floats and doubles to and from any format D described by fp_desc_t, one
+ *    value or a whole array at a time, with a rounding mode. Wrapped by
+ *    seqable, like Half, they show their bits as other types do.
+ *
+ *    bit_field<T, W> keeps one W-bit value in a whole T. bit_packed_t keeps a
+ *    whole array of W-bit values back to back, for any W from 1 to 64, and
+ *    still reads the i-th one directly. for_packed_t<T> stores offsets from
+ *    the smallest value, and delta_packed_t<T> the gaps between neighbours, 
+ *    which are small for sorted arrays.
+ *
+ *    ulp_diff() compares two arrays of floats or doubles bit by bit. It tells
+ *    how many ULPs apart each pair is, the largest and the mean distance, and 
+ *    which bits differ how often, in a short report. NaNs and signed zeros are
+ *    counted by themselves. Long arrays are split among threads.
+ *
+ *    We need C++20 to compile. Bulk loops are written for compilers to
+ *    vectorize, which g++ does at -O3.
  *
  *    THIS IS A TOY. DO NOT EXPECT TOO MUCH.
  */
 #include <iostream>
 #include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <climits>
+#include <array>
+#include <utility>
+#include <type_traits>
+#include <thread>
+#include <initializer_list>
+#include <memory>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
 using namespace std;
 
-#define OP_DEF(_OP_)                              \
-template <typename T>                             \
-auto &operator _OP_ (seqable<T> &a, const T &b) { \
-    a.data _OP_ b;                                \
-    return a;                                     \
+#define OP_DEF(_OP_)                                               \
+template <typename T>                                              \
+auto &operator _OP_ (seqable<T> &a, const type_identity_t<T> &b) { \
+    a.data _OP_ b;                                                 \
+    return a;                                                      \
+}                                                                  \
+template <typename T>                                              \
+auto &operator _OP_ (seqable<T> &a, const seqable<T> &b) {         \
+    a.data _OP_ b.data;                                            \
+    return a;                                                      \
 }
 
 template <typename T, uint32_t W>
@@ -53,11 +109,10 @@ const uint32_t bit_field<T, W>::w = W;
 
 template <typename T, uint32_t W>
 ostream &operator<< (ostream &o, const bit_field<T, W> &a){
-    uint32_t w = W;
-    T d = a._data, t = 0;
-    for (uint32_t i = 0; i < w; i++, d >>= 1) (t <<= 1) |= (d & 1);
-    for (uint32_t i = 0; i < w; i++, t >>= 1) o << (t & 1);
-    return o;
+    char s[W];
+    T d = a._data;
+    for (uint32_t i = 0; i < W; i++, d >>= 1) s[W - i - 1] = '0' + (d & 1);
+    return o.write(s, W);
 }
 
 using byte_t = bit_field<uint8_t, 8>;
@@ -66,34 +121,204 @@ struct bytes_t{
     byte_t data[N];
 };
 
+/*
+ *    Bulk dumps
+ *      Each byte is looked up in a table of its 8 bits or 2 hex digits, for
+ *      both orders, so no bit is handled one by one. An entry is followed by
+ *      a space and padded to 16 or 4 chars, and copied as a whole. The next
+ *      entry overwrites the space, unless a group ends there.
+ */
+struct dump_opts{
+    bool hex = false;           // hex digits, or bits
+    bool lsb_first = false;     // LSB of each byte to the LEFT
+    bool as_numbers = false;    // bytes of a group from high address to low,
+                                // like a little-endian number
+    uint32_t group = 1;         // bytes in a group, groups are split by a space
+    uint32_t line = 16;         // bytes in a line, 0 for no line breaks
+    bool offsets = false;       // hex offset at the start of each line
+};
+
+struct dump_tables{
+    char bin[2][256][16];
+    char hex[2][256][4];
+    constexpr dump_tables():bin{}, hex{}{
+        const char *digits = "0123456789abcdef";
+        for (uint32_t b = 0; b < 256; b ++){
+            for (uint32_t i = 0; i < 8; i ++){
+                bin[0][b][i] = '0' + ((b >> (7 - i)) & 1);
+                bin[1][b][i] = '0' + ((b >> i) & 1);
+            }
+            hex[0][b][0] = hex[1][b][1] = digits[b >> 4];
+            hex[0][b][1] = hex[1][b][0] = digits[b & 15];
+            bin[0][b][8] = bin[1][b][8] = hex[0][b][2] = hex[1][b][2] = ' ';
+        }
+    }
+};
+inline constexpr dump_tables dump_tab;
+
+// Groups have at least 1 byte, and lines have whole groups
+inline dump_opts dump_normalized(dump_opts o){
+    o.group = max<uint32_t>(o.group, 1);
+    if (o.line)
+        o.line = (o.line + o.group - 1) / o.group * o.group;
+    return o;
+}
+
+// Bytes that a block of lines, or a run of groups, is made of
+inline size_t dump_unit(const dump_opts &o){
+    dump_opts n = dump_normalized(o);
+    return n.line ? n.line : n.group;
+}
+
+// Largest number of chars that n bytes can take
+inline size_t dump_size(size_t n, const dump_opts &o){
+    size_t lines = o.line ? n / o.line + 2 : 1;
+    return n * (o.hex ? 2 : 8) + n / max<uint32_t>(o.group, 1) + 16 + lines * 20;
+}
+
+// w chars for each byte, and S chars for each entry of tab. Options are
+// copied, or they would be read again after each store of chars.
+template <size_t w, size_t S>
+size_t dump_bytes_w(const uint8_t *b, size_t n, char *out, const char (*tab)[S], 
+    const dump_opts o, uint64_t base){
+    const size_t group = o.group, line = o.line;
+    const bool as_numbers = o.as_numbers, offsets = o.offsets;
+    char *q = out;
+    if (!line && base && n)
+        *q ++ = ' ';
+    for (size_t i = 0; i < n; ){
+        size_t line_end = line ? min(n, i + line) : n;
+        if (line && offsets){
+            uint64_t off = base + i;
+            int digits = max<int>(8, (bit_width(off) + 3) / 4);
+            for (int d = digits - 1; d >= 0; d --)
+                *q ++ = "0123456789abcdef"[(off >> (4 * d)) & 15];
+            *q ++ = ':';
+            *q ++ = ' ';
+        }
+        if (as_numbers)
+            for (; i < line_end; ){
+                const size_t g = min(group, line_end - i);
+                for (size_t k = g; k --; q += w)
+                    memcpy(q, tab[b[i + k]], S);
+                i += g;
+                q += i < line_end;
+            }
+        else {
+            // Keeps the space when left reaches 0, and drops the last one
+            size_t left = group;
+            for (; i < line_end; i ++){
+                memcpy(q, tab[b[i]], S);
+                bool end = -- left == 0;
+                q += w + end;
+                left = end ? group : left;
+            }
+            q -= left == group;
+        }
+        if (line)
+            *q ++ = '\n';
+    }
+    return q - out;
+}
+
+// Writes n bytes from p to out, and returns the chars written. out must hold
+// dump_size(n, o) chars. base is the offset of p from the start of the dump,
+// and it must be a multiple of dump_unit(o).
+inline size_t dump_bytes(const void *p, size_t n, char *out, const dump_opts &o, 
+    uint64_t base = 0){
+    const uint8_t *b = static_cast<const uint8_t *>(p);
+    if (o.hex)
+        return dump_bytes_w<2>(b, n, out, dump_tab.hex[o.lsb_first], dump_normalized(o), base);
+    return dump_bytes_w<8>(b, n, out, dump_tab.bin[o.lsb_first], dump_normalized(o), base);
+}
+
+// Dumps from memory, a block of lines at a time
+inline void dump(ostream &out, const void *p, size_t n, const dump_opts &o = {}, 
+    uint64_t base = 0){
+    const size_t unit = dump_unit(o);
+    const size_t block = max<size_t>((1 << 16) / unit, 1) * unit;
+    vector<char> buf(dump_size(min(n, block), o));
+    const uint8_t *b = static_cast<const uint8_t *>(p);
+    for (size_t i = 0; i < n; i += block){
+        size_t k = min(block, n - i);
+        out.write(buf.data(), dump_bytes(b + i, k, buf.data(), o, base + i));
+    }
+}
+
+// Each value is a group, and written like its 'bytes' member by default
+template <typename T>
+void dump(ostream &out, span<const T> a, dump_opts o = {.as_numbers = true}){
+    o.group = sizeof(T);
+    if (o.line)
+        o.line = max<uint32_t>(o.line / sizeof(T), 1) * sizeof(T);
+    dump(out, a.data(), a.size_bytes(), o);
+}
+
+// Dumps what is read from in, chunk by chunk. Returns the bytes read.
+inline uint64_t dump_stream(istream &in, ostream &out, const dump_opts &o = {}, 
+    size_t chunk = 1 << 22){
+    const size_t unit = dump_unit(o);
+    chunk = max<size_t>(chunk / unit, 1) * unit;
+    vector<char> buf(chunk);
+    uint64_t total = 0;
+    while (in){
+        in.read(buf.data(), chunk);
+        size_t k = in.gcount();
+        dump(out, buf.data(), k, o, total);
+        total += k;
+    }
+    return total;
+}
+
 template <uint32_t N>
 ostream &operator<< (ostream &o, const bytes_t<N> &a){
-    for (uint32_t i = 0; i < N; i ++)
-        o << a.data[N - i - 1];
-    return o;
+    char s[N * 8 + 16];
+    return o.write(s, dump_bytes(a.data, N, s, {.as_numbers = true, .group = N, .line = 0}));
 }
 
-template <typename T, uint32_t M, uint32_t E, uint32_t S>
+// I is false for formats without Inf. Then, all bits of the exponent set are
+// still normal values, except the NaN with all bits of the mantissa set.
+template <typename T, uint32_t M, uint32_t E, uint32_t S, bool I = true>
 struct fp_desc_t{
     using int_val_t = T;
     static const uint32_t m_s, e_s, s_s;
+    static const bool has_inf;
 };
-template <typename T, uint32_t M, uint32_t E, uint32_t S>
-const uint32_t fp_desc_t<T, M, E, S>::m_s = M;
-template <typename T, uint32_t M, uint32_t E, uint32_t S>
-const uint32_t fp_desc_t<T, M, E, S>::e_s = E;
-template <typename T, uint32_t M, uint32_t E, uint32_t S>
-const uint32_t fp_desc_t<T, M, E, S>::s_s = S;
+template <typename T, uint32_t M, uint32_t E, uint32_t S, bool I>
+const uint32_t fp_desc_t<T, M, E, S, I>::m_s = M;
+template <typename T, uint32_t M, uint32_t E, uint32_t S, bool I>
+const uint32_t fp_desc_t<T, M, E, S, I>::e_s = E;
+template <typename T, uint32_t M, uint32_t E, uint32_t S, bool I>
+const uint32_t fp_desc_t<T, M, E, S, I>::s_s = S;
+template <typename T, uint32_t M, uint32_t E, uint32_t S, bool I>
+const bool fp_desc_t<T, M, E, S, I>::has_inf = I;
+
+using fp16_desc = fp_desc_t<uint16_t, 10, 5, 1>;           /*IEEE754 binary 16 Format*/
+using bf16_desc = fp_desc_t<uint16_t, 7, 8, 1>;            /*bfloat16, the top half of FP32*/
+using fp8_e4m3_desc = fp_desc_t<uint8_t, 3, 4, 1, false>;  /*FP8 E4M3, no Inf, max 448*/
+using fp8_e5m2_desc = fp_desc_t<uint8_t, 2, 5, 1>;         /*FP8 E5M2, a short binary 16*/
+
+template <typename D>
+struct packed_fp_t;
 
 template <typename T>
-using fp_desc =
+struct fp_desc_of{
+    using type =
     typename conditional< sizeof(T) == 8, fp_desc_t<uint64_t, 52, 11, 1>,         /*IEEE754 binary 64 Format*/
         typename conditional< sizeof(T) == 4, fp_desc_t<uint32_t, 23, 8 , 1>,     /*IEEE754 binary 32 Format*/
-            typename conditional< sizeof(T) == 2, fp_desc_t<uint16_t, 10, 5, 1>,  /*IEEE754 binary 16 Format*/
+            typename conditional< sizeof(T) == 2, fp16_desc,
                 void
             >::type
         >::type
     >::type;
+};
+template <typename D>
+struct fp_desc_of<packed_fp_t<D>>{
+    using type = D;
+};
+
+template <typename T>
+using fp_desc = typename fp_desc_of<T>::type;
 
 template <typename T>
 struct ieee754_t{
@@ -107,13 +332,268 @@ struct ieee754_t{
     val_type s:desc_type::s_s;
 };
 
+/*
+ *    Conversions between formats
+ *      From float or double to D, the significand is shifted right to the
+ *      width of D, and rounded by the bits shifted out. The exponent is put 
+ *      above it, so a carry of rounding goes into the exponent, as it should. 
+ *      Values below the normal range of D lose more bits and get exponent 0,
+ *      which is the subnormal encoding. Overflows become Inf, or the largest
+ *      value if the mode rounds toward it or if D has no Inf. So does Inf.
+ *      From D to float or double, there is no rounding at all.
+ */
+enum class fp_round { nearest_even, toward_zero, upward, downward };
+
+template <typename D, typename T>
+typename D::int_val_t fp_encode(T x, fp_round r = fp_round::nearest_even){
+    using S = fp_desc<T>;
+    using src_t = S::int_val_t;
+    using dst_t = D::int_val_t;
+    const int s_bias = (1 << (S::e_s - 1)) - 1, d_bias = (1 << (D::e_s - 1)) - 1;
+    const uint32_t s_emask = (1u << S::e_s) - 1, d_emask = (1u << D::e_s) - 1;
+    const uint64_t d_sign = uint64_t(1) << (D::m_s + D::e_s);
+    const uint64_t d_inf = uint64_t(d_emask) << D::m_s;
+    const uint64_t d_nan = D::has_inf ? d_inf | (uint64_t(1) << (D::m_s - 1)) : d_sign - 1;
+    const uint64_t d_max = D::has_inf ? d_inf - 1 : d_sign - 2;
+    src_t v;
+    memcpy(&v, &x, sizeof(v));
+    const bool neg = v >> (S::m_s + S::e_s);
+    const uint64_t sign = neg ? d_sign : 0;
+    const uint32_t e = (v >> S::m_s) & s_emask;
+    uint64_t sig = v & ((src_t(1) << S::m_s) - 1);
+    if (e == s_emask)
+        return dst_t(sign | (sig ? d_nan : D::has_inf ? d_inf : d_max));
+    if (e)
+        sig |= uint64_t(1) << S::m_s;
+    const int ue = e ? int(e) - s_bias : 1 - s_bias;
+    const int d_emin = 1 - d_bias;
+    const int shift = S::m_s - D::m_s + max(d_emin - ue, 0);
+    uint64_t bits = uint64_t(max(ue - d_emin, 0)) << D::m_s;
+    const uint64_t kept = shift < 64 ? sig >> shift : 0;
+    const uint64_t rest = shift < 64 ? sig & ((uint64_t(1) << shift) - 1) : sig;
+    bool up = false;
+    switch (r){
+    case fp_round::nearest_even:
+        if (shift < 64){
+            const uint64_t half = uint64_t(1) << (shift - 1);
+            up = rest > half || (rest == half && (kept & 1));
+        }
+        break;
+    case fp_round::toward_zero: break;
+    case fp_round::upward: up = !neg && rest; break;
+    case fp_round::downward: up = neg && rest; break;
+    }
+    bits += kept + up;
+    if (bits > d_max){
+        bool to_max = !D::has_inf || r == fp_round::toward_zero 
+            || (r == fp_round::upward && neg) || (r == fp_round::downward && !neg);
+        bits = to_max ? d_max : d_inf;
+    }
+    return dst_t(sign | bits);
+}
+
+template <typename T, typename D>
+T fp_decode(typename D::int_val_t b){
+    using S = fp_desc<T>;
+    using dst_t = S::int_val_t;
+    const int s_bias = (1 << (S::e_s - 1)) - 1, d_bias = (1 << (D::e_s - 1)) - 1;
+    const uint32_t d_emask = (1u << D::e_s) - 1;
+    const uint64_t d_sign = uint64_t(1) << (D::m_s + D::e_s);
+    const dst_t sign = dst_t(b & d_sign ? 1 : 0) << (S::m_s + S::e_s);
+    const uint32_t e = (b >> D::m_s) & d_emask;
+    const uint64_t m = b & ((uint64_t(1) << D::m_s) - 1);
+    dst_t bits;
+    if (D::has_inf ? e == d_emask : (b & (d_sign - 1)) == d_sign - 1){
+        bits = dst_t((1u << S::e_s) - 1) << S::m_s;
+        if (m || !D::has_inf)
+            bits |= (dst_t(1) << (S::m_s - 1)) | (dst_t(m) << (S::m_s - D::m_s));
+        bits |= sign;
+    }
+    else if (e == 0){
+        // m * 2^(emin - M), scaled by halves, all exact
+        T scale = 1;
+        for (int i = 0; i < d_bias - 1 + int(D::m_s); i ++)
+            scale /= 2;
+        T r = T(m) * scale;
+        return sign ? -r : r;
+    }
+    else
+        bits = sign | (dst_t(int(e) - d_bias + s_bias) << S::m_s) 
+            | (dst_t(m) << (S::m_s - D::m_s));
+    T r;
+    memcpy(&r, &bits, sizeof(r));
+    return r;
+}
+
+/*
+ *    Bulk conversions
+ *      The same steps as above, in loops where every branch is a select, on
+ *      unsigned integers as wide as the float or double, and the rounding mode
+ *      is a template argument. So loops over any format and any mode are free
+ *      of branches, and compilers vectorize them. With F16C, floats go to and
+ *      from binary16 by the hardware, eight at a time.
+ */
+template <typename D, fp_round R, typename T>
+void fp_encode_n(const T *in, typename D::int_val_t *out, size_t n){
+    using S = fp_desc<T>;
+    using src_t = S::int_val_t;
+    using int_t = make_signed_t<src_t>;
+    const int_t s_bias = (1 << (S::e_s - 1)) - 1, d_bias = (1 << (D::e_s - 1)) - 1;
+    const int_t d_emin = 1 - d_bias;
+    const src_t s_emask = (src_t(1) << S::e_s) - 1, d_emask = (src_t(1) << D::e_s) - 1;
+    const src_t d_sign = src_t(1) << (D::m_s + D::e_s);
+    const src_t d_inf = d_emask << D::m_s;
+    const src_t d_nan = D::has_inf ? d_inf | (src_t(1) << (D::m_s - 1)) : d_sign - 1;
+    const src_t d_max = D::has_inf ? d_inf - 1 : d_sign - 2;
+    for (size_t i = 0; i < n; i ++){
+        const src_t v = bit_cast<src_t>(in[i]);
+        const src_t neg = v >> (S::m_s + S::e_s);
+        const src_t e = (v >> S::m_s) & s_emask;
+        const src_t frac = v & ((src_t(1) << S::m_s) - 1);
+        const src_t sig = frac | (src_t(e != 0) << S::m_s);
+        const int_t ue = int_t(max<src_t>(e, 1)) - s_bias;
+        // Shifts past the significand only leave sticky bits, as in fp_encode
+        const src_t shift = min<int_t>(S::m_s - D::m_s + max<int_t>(d_emin - ue, 0), 
+            sizeof(src_t) * CHAR_BIT - 1);
+        const src_t kept = sig >> shift;
+        const src_t rest = sig - (kept << shift);
+        src_t up = 0;
+        if constexpr (R == fp_round::nearest_even){
+            // Up from half of the last kept bit, and from a tie to an odd one
+            const src_t twice = rest << 1, half = twice >> shift;
+            up = half & ((twice != half << shift) | kept);
+        }
+        else if constexpr (R == fp_round::upward)
+            up = (neg ^ 1) & (rest != 0);
+        else if constexpr (R == fp_round::downward)
+            up = neg & (rest != 0);
+        src_t bits = (src_t(max<int_t>(ue - d_emin, 0)) << D::m_s) + kept + up;
+        // Selects by masks, g++ turns ?: here into branches
+        const src_t to_max = -src_t(!D::has_inf || R == fp_round::toward_zero 
+            || (R == fp_round::upward && neg) || (R == fp_round::downward && !neg));
+        const src_t over = -src_t(bits > d_max), special = -src_t(e == s_emask);
+        const src_t nan = -src_t(frac != 0);
+        bits = (((d_max & to_max) | (d_inf & ~to_max)) & over) | (bits & ~over);
+        bits = (((d_nan & nan) | ((D::has_inf ? d_inf : d_max) & ~nan)) & special) 
+            | (bits & ~special);
+        out[i] = typename D::int_val_t(neg * d_sign | bits);
+    }
+}
+
+template <typename T, typename D>
+void fp_decode_n(const typename D::int_val_t *in, T *out, size_t n){
+    using S = fp_desc<T>;
+    using dst_t = S::int_val_t;
+    constexpr dst_t s_bias = (1 << (S::e_s - 1)) - 1, d_bias = (1 << (D::e_s - 1)) - 1;
+    const dst_t d_emask = (dst_t(1) << D::e_s) - 1;
+    const dst_t d_sign = dst_t(1) << (D::m_s + D::e_s);
+    // 2^(emin - M) for subnormals, all exact
+    constexpr T scale = []{
+        T r = 1;
+        for (int i = 0; i < int(d_bias) - 1 + int(D::m_s); i ++)
+            r /= 2;
+        return r;
+    }();
+    for (size_t i = 0; i < n; i ++){
+        const dst_t x = in[i];
+        const dst_t e = (x >> D::m_s) & d_emask;
+        const dst_t m = x & ((dst_t(1) << D::m_s) - 1);
+        dst_t bits = ((e + s_bias - d_bias) << S::m_s) | (m << (S::m_s - D::m_s));
+        // With as many exponent bits, like bfloat16, subnormals are the same 
+        // bits as above, and scale itself would be a slow subnormal
+        if constexpr (D::e_s < S::e_s){
+            const T sub = T(int32_t(m)) * scale;
+            dst_t sub_bits;
+            memcpy(&sub_bits, &sub, sizeof(sub));
+            const dst_t z = -dst_t(e == 0);
+            bits = (sub_bits & z) | (bits & ~z);
+        }
+        const dst_t nan_bits = (((dst_t(1) << S::e_s) - 1) << S::m_s) | dst_t(m != 0 || 
+            !D::has_inf) * ((dst_t(1) << (S::m_s - 1)) | (m << (S::m_s - D::m_s)));
+        const bool special = D::has_inf ? e == d_emask : (x & (d_sign - 1)) == d_sign - 1;
+        // Selects by masks, g++ turns ?: here into branches
+        const dst_t sp = -dst_t(special);
+        bits = (nan_bits & sp) | (bits & ~sp) | ((x >> (D::m_s + D::e_s)) << (S::m_s + S::e_s));
+        memcpy(&out[i], &bits, sizeof(bits));
+    }
+}
+
+template <typename D, typename T>
+void fp_encode(span<const T> in, typename D::int_val_t *out, 
+    fp_round r = fp_round::nearest_even){
+    size_t i = 0;
+    if constexpr (is_same_v<T, float> && is_same_v<D, fp16_desc>){
+#ifdef __F16C__
+        for (; i + 8 <= in.size(); i += 8){
+            __m256 v = _mm256_loadu_ps(&in[i]);
+            __m128i h;
+            switch (r){
+            case fp_round::nearest_even: h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT); break;
+            case fp_round::toward_zero: h = _mm256_cvtps_ph(v, _MM_FROUND_TO_ZERO); break;
+            case fp_round::upward: h = _mm256_cvtps_ph(v, _MM_FROUND_TO_POS_INF); break;
+            default: h = _mm256_cvtps_ph(v, _MM_FROUND_TO_NEG_INF); break;
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), h);
+        }
+#endif
+    }
+    const T *p = in.data() + i;
+    const size_t n = in.size() - i;
+    switch (r){
+    case fp_round::nearest_even: fp_encode_n<D, fp_round::nearest_even>(p, out + i, n); break;
+    case fp_round::toward_zero: fp_encode_n<D, fp_round::toward_zero>(p, out + i, n); break;
+    case fp_round::upward: fp_encode_n<D, fp_round::upward>(p, out + i, n); break;
+    case fp_round::downward: fp_encode_n<D, fp_round::downward>(p, out + i, n); break;
+    }
+}
+
+template <typename T, typename D>
+void fp_decode(const typename D::int_val_t *in, span<T> out){
+    size_t i = 0;
+    if constexpr (is_same_v<T, float> && is_same_v<D, fp16_desc>){
+#ifdef __F16C__
+        for (; i + 8 <= out.size(); i += 8)
+            _mm256_storeu_ps(&out[i], _mm256_cvtph_ps(
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i))));
+#endif
+    }
+    fp_decode_n<T, D>(in + i, out.data() + i, out.size() - i);
+}
+
+// A value stored in format D. Arithmetic is done in double and rounded back.
+template <typename D>
+struct packed_fp_t{
+    typename D::int_val_t bits;
+    packed_fp_t() = default;
+    packed_fp_t(double a):bits(fp_encode<D>(a)){}
+    operator float() const { return fp_decode<float, D>(bits); }
+    packed_fp_t &operator+= (packed_fp_t a){ return *this = double(*this) + double(a); }
+    packed_fp_t &operator-= (packed_fp_t a){ return *this = double(*this) - double(a); }
+    packed_fp_t &operator*= (packed_fp_t a){ return *this = double(*this) * double(a); }
+    packed_fp_t &operator/= (packed_fp_t a){ return *this = double(*this) / double(a); }
+};
+
+template <typename D>
+ostream &operator<< (ostream &o, const packed_fp_t<D> &a){ return o << float(a); }
+
+using half_t = packed_fp_t<fp16_desc>;
+using bfloat16_t = packed_fp_t<bf16_desc>;
+using fp8_e4m3_t = packed_fp_t<fp8_e4m3_desc>;
+using fp8_e5m2_t = packed_fp_t<fp8_e5m2_desc>;
+
+template <typename T>
+inline constexpr bool is_packed_fp = false;
+template <typename D>
+inline constexpr bool is_packed_fp<packed_fp_t<D>> = true;
+
 template <typename T>
 union seqable{
     T data;
     bytes_t<sizeof(T)> bytes;
-    const ieee754_t<T> &ieee754() requires (is_floating_point<T>::value){
+    const ieee754_t<T> &ieee754() requires (is_floating_point<T>::value || is_packed_fp<T>){
         return *reinterpret_cast<ieee754_t<T>*>(&data);
     }
+    seqable():data(){}
     seqable(const T &a){ data = a; }
     operator T(){ return data; }
     const seqable<T> &operator= (const T &a){
@@ -134,6 +614,661 @@ using Int32 = seqable<int32_t>;
 using UInt32 = seqable<uint32_t>;
 using Char = seqable<char>;
 using Bool = seqable<bool>;
+using Half = seqable<half_t>;
+using BFloat16 = seqable<bfloat16_t>;
+using FP8E4M3 = seqable<fp8_e4m3_t>;
+using FP8E5M2 = seqable<fp8_e5m2_t>;
+
+/*
+ *    Arrays of seqables
+ *      A seqable<T> is as large as T, so an array of T can be looked at as an
+ *      array of them. A seqable_array<T> made from a span<T> is a view, like
+ *      the span, and compound operators change the values in place. Results
+ *      of other operators are new arrays, shared by all copies of them.
+ *      Operators are made by the macros below, each is a plain loop over
+ *      .data, which compilers vectorize. Bitwise operators on floating points
+ *      work on their bits. Arrays of different sizes give the shorter size.
+ */
+template <typename T>
+class seqable_array{
+public:
+    seqable_array(span<T> s):p(reinterpret_cast<seqable<T> *>(s.data())), n(s.size()){}
+    seqable_array(size_t n = 0, const T &v = T())
+        :own(make_shared<seqable<T>[]>(n, seqable<T>(v))), p(own.get()), n(n){}
+    seqable_array(initializer_list<T> l):seqable_array(l.size()){
+        copy(l.begin(), l.end(), reinterpret_cast<T *>(p));
+    }
+
+    size_t size() const { return n; }
+    seqable<T> &operator[](size_t i){ return p[i]; }
+    const seqable<T> &operator[](size_t i) const { return p[i]; }
+    seqable<T> *data(){ return p; }
+    const seqable<T> *data() const { return p; }
+    seqable<T> *begin(){ return p; }
+    seqable<T> *end(){ return p + n; }
+    // As an array of T, for dump() and others
+    span<const T> values() const { return {reinterpret_cast<const T *>(p), n}; }
+private:
+    shared_ptr<seqable<T>[]> own;   // null for views
+    seqable<T> *p;
+    size_t n;
+};
+
+template <typename T>
+ostream &operator<< (ostream &o, const seqable_array<T> &a){
+    for (size_t i = 0; i < a.size(); i ++){
+        o << (i ? " " : "");
+        if constexpr (is_integral_v<T> && sizeof(T) == 1)
+            o << int(a[i].data);
+        else
+            o << a[i].data;
+    }
+    return o;
+}
+
+// x op y on the bits of floating points
+template <typename T, typename F>
+T seq_bits(T x, T y, F f){
+    if constexpr (is_floating_point_v<T>){
+        using U = fp_desc<T>::int_val_t;
+        U u, v;
+        memcpy(&u, &x, sizeof(T));
+        memcpy(&v, &y, sizeof(T));
+        u = f(u, v);
+        memcpy(&x, &u, sizeof(T));
+        return x;
+    }
+    else
+        return T(f(x, y));
+}
+
+// r[i] = f(x(i), y(i)) for i in [0, n)
+template <typename R, typename X, typename Y, typename F>
+seqable_array<R> seq_zip(size_t n, X x, Y y, F f){
+    seqable_array<R> r(n);
+    seqable<R> *o = r.data();
+    for (size_t i = 0; i < n; i ++)
+        o[i].data = R(f(x(i), y(i)));
+    return r;
+}
+
+template <typename T>
+auto seq_at(const seqable_array<T> &a){ 
+    return [p = a.data()](size_t i){ return p[i].data; }; 
+}
+
+template <typename T>
+auto seq_at(const T &v){ return [v](size_t){ return v; }; }
+
+template <typename T, typename F>
+seqable_array<T> &seq_apply(seqable_array<T> &a, const seqable_array<T> &b, F f){
+    seqable<T> *p = a.data();
+    const seqable<T> *q = b.data();
+    for (size_t i = 0, n = min(a.size(), b.size()); i < n; i ++)
+        p[i].data = T(f(p[i].data, q[i].data));
+    return a;
+}
+
+template <typename T, typename F>
+seqable_array<T> &seq_apply(seqable_array<T> &a, const T &v, F f){
+    seqable<T> *p = a.data();
+    for (size_t i = 0; i < a.size(); i ++)
+        p[i].data = T(f(p[i].data, v));
+    return a;
+}
+
+// _R_ is the type of results, _F_ computes x _OP_ y
+#define SEQ_OP_DEF(_OP_, _R_, _F_)                                              \
+template <typename T> requires requires (T x, T y) { _F_; }                     \
+seqable_array<_R_> operator _OP_ (const seqable_array<T> &a,                    \
+    const seqable_array<T> &b) {                                                \
+    return seq_zip<_R_>(min(a.size(), b.size()), seq_at(a), seq_at(b),          \
+        [](T x, T y){ return _F_; });                                           \
+}                                                                               \
+template <typename T> requires requires (T x, T y) { _F_; }                     \
+seqable_array<_R_> operator _OP_ (const seqable_array<T> &a,                    \
+    const type_identity_t<T> &v) {                                              \
+    return seq_zip<_R_>(a.size(), seq_at(a), seq_at(v),                         \
+        [](T x, T y){ return _F_; });                                           \
+}                                                                               \
+template <typename T> requires requires (T x, T y) { _F_; }                     \
+seqable_array<_R_> operator _OP_ (const type_identity_t<T> &v,                  \
+    const seqable_array<T> &a) {                                                \
+    return seq_zip<_R_>(a.size(), seq_at(v), seq_at(a),                         \
+        [](T x, T y){ return _F_; });                                           \
+}
+
+// Compound ones, a _OP_= b, or a _OP_= v
+#define SEQ_SET_DEF(_OP_, _F_)                                                  \
+template <typename T> requires requires (T x, T y) { _F_; }                     \
+seqable_array<T> &operator _OP_ (seqable_array<T> &a, const seqable_array<T> &b){ \
+    return seq_apply(a, b, [](T x, T y){ return _F_; });                        \
+}                                                                               \
+template <typename T> requires requires (T x, T y) { _F_; }                     \
+seqable_array<T> &operator _OP_ (seqable_array<T> &a, const type_identity_t<T> &v){ \
+    return seq_apply(a, v, [](T x, T y){ return _F_; });                        \
+}
+
+SEQ_OP_DEF(+, T, x + y)
+SEQ_OP_DEF(-, T, x - y)
+SEQ_OP_DEF(*, T, x * y)
+SEQ_OP_DEF(/, T, x / y)
+SEQ_OP_DEF(%, T, x % y)
+SEQ_OP_DEF(&, T, seq_bits(x, y, [](auto u, auto v){ return u & v; }))
+SEQ_OP_DEF(|, T, seq_bits(x, y, [](auto u, auto v){ return u | v; }))
+SEQ_OP_DEF(^, T, seq_bits(x, y, [](auto u, auto v){ return u ^ v; }))
+SEQ_OP_DEF(<<, T, x << y)
+SEQ_OP_DEF(>>, T, x >> y)
+SEQ_OP_DEF(==, bool, x == y)
+SEQ_OP_DEF(!=, bool, x != y)
+SEQ_OP_DEF(<, bool, x < y)
+SEQ_OP_DEF(<=, bool, x <= y)
+SEQ_OP_DEF(>, bool, x > y)
+SEQ_OP_DEF(>=, bool, x >= y)
+
+SEQ_SET_DEF(+=, x + y)
+SEQ_SET_DEF(-=, x - y)
+SEQ_SET_DEF(*=, x * y)
+SEQ_SET_DEF(/=, x / y)
+SEQ_SET_DEF(%=, x % y)
+SEQ_SET_DEF(&=, seq_bits(x, y, [](auto u, auto v){ return u & v; }))
+SEQ_SET_DEF(|=, seq_bits(x, y, [](auto u, auto v){ return u | v; }))
+SEQ_SET_DEF(^=, seq_bits(x, y, [](auto u, auto v){ return u ^ v; }))
+
+template <typename T>
+seqable_array<T> operator- (const seqable_array<T> &a){
+    return seq_zip<T>(a.size(), seq_at(a), seq_at(T()), [](T x, T){ return -x; });
+}
+
+/*
+ *    Bulk IEEE754 fields
+ *      Values are loaded as their unsigned integers, and fields are cut out
+ *      by shifts and masks. There is no branch in the loops, so compilers
+ *      can vectorize them.
+ */
+template <typename T>
+struct ieee754_columns_t{
+    using desc_type = fp_desc<T>;
+    using val_type = desc_type::int_val_t;
+    vector<uint8_t> s;
+    vector<uint16_t> e;     // biased, as stored
+    vector<val_type> m;
+};
+
+template <typename T>
+void ieee754_split(span<const T> a, uint8_t *s, uint16_t *e, 
+    typename fp_desc<T>::int_val_t *m){
+    using desc_type = fp_desc<T>;
+    using val_type = desc_type::int_val_t;
+    const val_type m_mask = (val_type(1) << desc_type::m_s) - 1;
+    const val_type e_mask = (val_type(1) << desc_type::e_s) - 1;
+    const uint32_t s_shift = desc_type::m_s + desc_type::e_s;
+    for (size_t i = 0; i < a.size(); i ++){
+        val_type v;
+        memcpy(&v, &a[i], sizeof(v));
+        s[i] = v >> s_shift;
+        e[i] = (v >> desc_type::m_s) & e_mask;
+        m[i] = v & m_mask;
+    }
+}
+
+template <typename T>
+ieee754_columns_t<T> ieee754_split(span<const T> a){
+    ieee754_columns_t<T> r;
+    r.s.resize(a.size());
+    r.e.resize(a.size());
+    r.m.resize(a.size());
+    ieee754_split(a, r.s.data(), r.e.data(), r.m.data());
+    return r;
+}
+
+template <typename T>
+struct ieee754_stats_t{
+    using desc_type = fp_desc<T>;
+    using val_type = desc_type::int_val_t;
+    static const int bias = (1 << (desc_type::e_s - 1)) - 1;
+    static const uint32_t e_max = (1u << desc_type::e_s) - 1;
+
+    vector<uint64_t> hist = vector<uint64_t>(e_max + 1);  // by biased exponent
+    uint64_t n = 0, negatives = 0, zeros = 0, subnormals = 0, infs = 0, nans = 0;
+    T min_abs{}, max_abs{};     // of finite values that are not zero
+
+    uint64_t normals() const { return n - zeros - subnormals - infs - nans; }
+    uint64_t finite_nonzero() const { return normals() + subnormals; }
+    // Normal values with biased exponent e
+    uint64_t normals_at(uint32_t e) const { 
+        return e == 0 ? 0 : e == e_max ? hist[e] - infs - nans : hist[e]; 
+    }
+    // Unbiased exponents of the smallest and the largest normal values
+    int min_exp() const {
+        for (uint32_t e = 1; e <= e_max; e ++)
+            if (normals_at(e)) return int(e) - bias;
+        return 0;
+    }
+    int max_exp() const {
+        for (uint32_t e = e_max; e > 0; e --)
+            if (normals_at(e)) return int(e) - bias;
+        return 0;
+    }
+    // log2(max_abs / min_abs)
+    double dynamic_range() const {
+        return finite_nonzero() ? log2(double(max_abs)) - log2(double(min_abs)) : 0;
+    }
+    // Finite values that are too large for format D, and nonzero values that
+    // would be subnormal or zero in D
+    template <typename D>
+    uint64_t overflows() const { 
+        const int d_max = (1 << (D::e_s - 1)) - 1;
+        return count_exp(d_max + 1, INT_MAX); 
+    }
+    template <typename D>
+    uint64_t underflows() const { 
+        const int d_min = 2 - (1 << (D::e_s - 1));
+        return count_exp(INT_MIN, d_min - 1) + subnormals; 
+    }
+
+private:
+    // Normal values with unbiased exponents in [lo, hi]
+    uint64_t count_exp(int lo, int hi) const {
+        uint64_t c = 0;
+        for (uint32_t e = 1; e <= e_max; e ++)
+            if (int(e) - bias >= lo && int(e) - bias <= hi)
+                c += normals_at(e);
+        return c;
+    }
+};
+
+// One pass over a. Magnitudes are compared as integers, which keep the order
+// of non-negative floating points. In formats without Inf, the only special
+// magnitude is the NaN with all bits set.
+template <typename T>
+ieee754_stats_t<T> ieee754_stats(span<const T> a){
+    using stats_type = ieee754_stats_t<T>;
+    using desc_type = fp_desc<T>;
+    using val_type = desc_type::int_val_t;
+    const uint32_t s_shift = desc_type::m_s + desc_type::e_s;
+    const val_type abs_mask = (val_type(1) << s_shift) - 1;
+    const val_type inf_bits = desc_type::has_inf ? 
+        val_type(stats_type::e_max) << desc_type::m_s : abs_mask;
+    stats_type r;
+    // Four histograms, so that equal exponents in a row do not wait on 
+    // each other
+    vector<uint64_t> h(4 * (stats_type::e_max + 1));
+    val_type lo = inf_bits, hi = 0;
+    uint64_t neg = 0, zeros = 0, infs = 0;
+    for (size_t i = 0; i < a.size(); i ++){
+        val_type v;
+        memcpy(&v, &a[i], sizeof(v));
+        val_type m = v & abs_mask;
+        h[(i & 3) * (stats_type::e_max + 1) + (m >> desc_type::m_s)] ++;
+        neg += v >> s_shift;
+        zeros += m == 0;
+        infs += m == inf_bits;
+        bool finite_nonzero = m != 0 && m < inf_bits;
+        lo = finite_nonzero && m < lo ? m : lo;
+        hi = finite_nonzero && m > hi ? m : hi;
+    }
+    for (size_t k = 0; k < 4; k ++)
+        for (uint32_t e = 0; e <= stats_type::e_max; e ++)
+            r.hist[e] += h[k * (stats_type::e_max + 1) + e];
+    r.n = a.size();
+    r.negatives = neg;
+    r.zeros = zeros;
+    r.subnormals = r.hist[0] - zeros;
+    r.infs = desc_type::has_inf ? infs : 0;
+    r.nans = desc_type::has_inf ? r.hist[stats_type::e_max] - infs : infs;
+    if (hi){
+        memcpy(&r.min_abs, &lo, sizeof(T));
+        memcpy(&r.max_abs, &hi, sizeof(T));
+    }
+    return r;
+}
+
+template <typename T>
+ostream &operator<< (ostream &o, const ieee754_stats_t<T> &a){
+    o << "n " << a.n << ", zeros " << a.zeros << ", subnormals " << a.subnormals
+      << ", infs " << a.infs << ", nans " << a.nans << ", negatives " << a.negatives;
+    if (a.finite_nonzero())
+        o << ", |x| in [" << a.min_abs << ", " << a.max_abs << "], exponents [" 
+          << a.min_exp() << ", " << a.max_exp() << "], range 2^" << a.dynamic_range();
+    return o;
+}
+
+/*
+ *    Bit packing
+ *      Value i takes bits [i * W, i * W + W) of the words, LSB first. One 
+ *      more word is kept at the end, so a value is always read from two
+ *      words without a branch. Unpacking has a loop for each W, in which
+ *      shifts are constants that compilers unroll and vectorize.
+ */
+template <uint32_t W, typename T>
+void bit_unpack_w(const uint64_t *words, size_t first, size_t n, T *out){
+    const uint64_t mask = W == 64 ? ~uint64_t(0) : (uint64_t(1) << W) - 1;
+    auto one = [&](size_t i){
+        uint64_t p = (first + i) * W;
+        const uint64_t *q = words + (p >> 6);
+        uint32_t s = p & 63;
+        out[i] = T(((q[0] >> s) | ((q[1] << 1) << (63 - s))) & mask);
+    };
+    size_t i = 0;
+    for (; i < n && (first + i) % 64; i ++)
+        one(i);
+    // 64 values take W whole words, all shifts are known
+    for (; i + 64 <= n; i += 64){
+        const uint64_t *q = words + (first + i) / 64 * W;
+#pragma GCC unroll 64
+        for (uint32_t j = 0; j < 64; j ++){
+            const uint32_t p = j * W, k = p >> 6, s = p & 63;
+            out[i + j] = T(((q[k] >> s) | ((q[k + 1] << 1) << (63 - s))) & mask);
+        }
+    }
+    for (; i < n; i ++)
+        one(i);
+}
+
+template <typename T>
+using bit_unpack_fn = void (*)(const uint64_t *, size_t, size_t, T *);
+
+template <typename T>
+inline constexpr auto bit_unpack_table = []<size_t... w>(index_sequence<w...>){
+    return array<bit_unpack_fn<T>, 64>{ &bit_unpack_w<w + 1, T>... };
+}(make_index_sequence<64>{});
+
+// Bits needed by the largest value
+template <typename T>
+uint32_t bits_needed(span<const T> a){
+    using U = make_unsigned_t<T>;
+    U m = 0;
+    for (const T &v: a)
+        m |= U(v);
+    return max<uint32_t>(bit_width(m), 1);
+}
+
+class bit_packed_t{
+public:
+    bit_packed_t(uint32_t w = 1, size_t n = 0)
+        :w(clamp<uint32_t>(w, 1, 64)), n(n), data((n * this->w + 63) / 64 + 1){}
+
+    // Values are cut to their lowest w bits, w = 0 takes as few as needed
+    template <typename T>
+    static bit_packed_t pack(span<const T> a, uint32_t w = 0){
+        bit_packed_t r(w ? w : bits_needed(a), a.size());
+        for (size_t i = 0; i < a.size(); i ++)
+            r.put(i, uint64_t(make_unsigned_t<T>(a[i])));
+        return r;
+    }
+
+    uint32_t width() const { return w; }
+    size_t size() const { return n; }
+    size_t bytes() const { return data.size() * sizeof(uint64_t); }
+    const vector<uint64_t> &words() const { return data; }
+
+    uint64_t operator[](size_t i) const {
+        uint64_t p = i * w;
+        const uint64_t *q = data.data() + (p >> 6);
+        uint32_t s = p & 63;
+        return ((q[0] >> s) | ((q[1] << 1) << (63 - s))) & mask();
+    }
+    void set(size_t i, uint64_t v){
+        uint64_t p = i * w;
+        uint64_t *q = data.data() + (p >> 6);
+        uint32_t s = p & 63;
+        uint64_t m = mask();
+        q[0] &= ~(m << s);
+        q[1] &= ~((m >> 1) >> (63 - s));
+        put(i, v);
+    }
+
+    // Values [first, first + out.size()) to out
+    template <typename T>
+    void unpack(span<T> out, size_t first = 0) const {
+        bit_unpack_table<T>[w - 1](data.data(), first, out.size(), out.data());
+    }
+
+private:
+    uint64_t mask() const { return w == 64 ? ~uint64_t(0) : (uint64_t(1) << w) - 1; }
+    // For a slot of zeros
+    void put(size_t i, uint64_t v){
+        v &= mask();
+        uint64_t p = i * w;
+        uint64_t *q = data.data() + (p >> 6);
+        uint32_t s = p & 63;
+        q[0] |= v << s;
+        q[1] |= (v >> 1) >> (63 - s);
+    }
+
+    uint32_t w;
+    size_t n;
+    vector<uint64_t> data;
+};
+
+// Frame of reference, values are offsets from the smallest one
+template <typename T>
+class for_packed_t{
+public:
+    using U = make_unsigned_t<T>;
+    for_packed_t(span<const T> a){
+        base = a.empty() ? T() : *min_element(a.begin(), a.end());
+        vector<U> d(a.size());
+        for (size_t i = 0; i < a.size(); i ++)
+            d[i] = U(a[i]) - U(base);
+        bits = bit_packed_t::pack(span<const U>(d));
+    }
+    size_t size() const { return bits.size(); }
+    size_t bytes() const { return bits.bytes() + sizeof(T); }
+    const bit_packed_t &packed() const { return bits; }
+    T operator[](size_t i) const { return T(U(base) + U(bits[i])); }
+    void unpack(span<T> out, size_t first = 0) const {
+        bits.unpack(out, first);
+        for (T &v: out)
+            v = T(U(v) + U(base));
+    }
+private:
+    T base;
+    bit_packed_t bits;
+};
+
+// Gaps between neighbours. Every block values, the value itself is kept, so
+// the i-th one is at most block - 1 gaps away. Gaps wrap around, unsorted 
+// arrays still work, but they take more bits.
+template <typename T>
+class delta_packed_t{
+public:
+    using U = make_unsigned_t<T>;
+    static const size_t block = 128;
+    delta_packed_t(span<const T> a){
+        vector<U> d(a.size());
+        for (size_t i = 0; i < a.size(); i ++){
+            if (i % block == 0)
+                anchors.push_back(a[i]);
+            d[i] = i % block ? U(a[i]) - U(a[i - 1]) : 0;
+        }
+        gaps = bit_packed_t::pack(span<const U>(d));
+    }
+    size_t size() const { return gaps.size(); }
+    size_t bytes() const { return gaps.bytes() + anchors.size() * sizeof(T); }
+    T operator[](size_t i) const {
+        U v = U(anchors[i / block]);
+        for (size_t k = i / block * block + 1; k <= i; k ++)
+            v += U(gaps[k]);
+        return T(v);
+    }
+    void unpack(span<T> out, size_t first = 0) const {
+        gaps.unpack(out, first);
+        // A run from the middle of a block starts from the value itself
+        U v = out.empty() || first % block == 0 ? 0 : U((*this)[first]);
+        for (size_t i = 0; i < out.size(); i ++){
+            size_t k = first + i;
+            if (k % block == 0)
+                v = U(anchors[k / block]);
+            else if (i)
+                v += U(out[i]);
+            out[i] = T(v);
+        }
+    }
+private:
+    vector<T> anchors;
+    bit_packed_t gaps;
+};
+
+/*
+ *    ULP distances
+ *      Bits of a floating point are mapped to an unsigned integer in the same 
+ *      order as the values, negative ones flipped below positive ones. The
+ *      distance of two values is the difference of their integers. Blocks of
+ *      equal bits are found first by a loop that compilers vectorize, only
+ *      blocks with differences are looked at one by one.
+ */
+struct ulp_opts{
+    bool nan_equal = true;      // NaN against NaN matches, whatever the payload
+    bool signed_zero = false;   // -0 against +0 is 1 ULP, or they match
+    uint32_t threads = 0;       // 0 for all cores
+    uint32_t keep = 8;          // where the first differences are
+};
+
+template <typename T>
+struct ulp_report_t{
+    size_t n = 0, differ = 0, nan_mismatches = 0, zero_mismatches = 0;
+    uint64_t max_ulp = 0;                       // NaN mismatches are not in
+    size_t max_at = 0;                          // these, but by themselves
+    double sum_ulp = 0;
+    array<uint64_t, 65> ulp_hist{};             // by bit_width of distances
+    array<uint64_t, sizeof(T) * 8> bit_flips{}; // pairs that differ at each bit
+    vector<size_t> first;
+
+    double mean_ulp() const { 
+        return n > nan_mismatches ? sum_ulp / (n - nan_mismatches) : 0; 
+    }
+    // b comes after this one in the arrays
+    void merge(const ulp_report_t &b, size_t keep){
+        if (b.max_ulp > max_ulp){
+            max_ulp = b.max_ulp;
+            max_at = b.max_at;
+        }
+        n += b.n;
+        differ += b.differ;
+        nan_mismatches += b.nan_mismatches;
+        zero_mismatches += b.zero_mismatches;
+        sum_ulp += b.sum_ulp;
+        for (size_t k = 0; k < ulp_hist.size(); k ++)
+            ulp_hist[k] += b.ulp_hist[k];
+        for (size_t k = 0; k < bit_flips.size(); k ++)
+            bit_flips[k] += b.bit_flips[k];
+        for (size_t i: b.first)
+            if (first.size() < keep)
+                first.push_back(i);
+    }
+};
+
+// Pairs [lo, hi), distances to ulps if it is there. A NaN mismatch is 
+// UINT64_MAX ULPs.
+template <typename T>
+void ulp_diff_range(const T *a, const T *b, size_t lo, size_t hi, 
+    const ulp_opts &o, uint64_t *ulps, ulp_report_t<T> &r){
+    using U = fp_desc<T>::int_val_t;
+    const U sign = U(1) << (sizeof(T) * 8 - 1);
+    const U inf = U(((U(1) << fp_desc<T>::e_s) - 1)) << fp_desc<T>::m_s;
+    const size_t block = 256;
+    // Without signed zeros, negative ones move up by 1, -0 is then on +0
+    const U shift = !o.signed_zero;
+    auto key = [&](U v){ return v & sign ? U(~v + shift) : U(v | sign); };
+    r.n += hi - lo;
+    for (size_t s = lo; s < hi; s += block){
+        const size_t e = min(hi, s + block);
+        U any = 0;
+        for (size_t i = s; i < e; i ++){
+            U va, vb;
+            memcpy(&va, a + i, sizeof(U));
+            memcpy(&vb, b + i, sizeof(U));
+            any |= va ^ vb;
+        }
+        if (!any){
+            if (ulps)
+                fill(ulps + s, ulps + e, 0);
+            continue;
+        }
+        for (size_t i = s; i < e; i ++){
+            U va, vb;
+            memcpy(&va, a + i, sizeof(U));
+            memcpy(&vb, b + i, sizeof(U));
+            U x = va ^ vb;
+            uint64_t d = 0;
+            if (x){
+                for (U f = x; f; f &= f - 1)
+                    r.bit_flips[countr_zero(f)] ++;
+                bool na = (va & ~sign) > inf, nb = (vb & ~sign) > inf;
+                if (na || nb){
+                    if (!(na && nb && o.nan_equal)){
+                        r.nan_mismatches ++;
+                        r.differ ++;
+                        if (r.first.size() < o.keep)
+                            r.first.push_back(i);
+                        d = UINT64_MAX;
+                    }
+                }
+                else {
+                    U ka = key(va), kb = key(vb);
+                    d = ka > kb ? ka - kb : kb - ka;
+                    r.zero_mismatches += !(va & ~sign) && !(vb & ~sign);
+                    r.sum_ulp += d;
+                }
+                if (d && d != UINT64_MAX){
+                    r.differ ++;
+                    r.ulp_hist[bit_width(d)] ++;
+                    if (d > r.max_ulp){
+                        r.max_ulp = d;
+                        r.max_at = i;
+                    }
+                    if (r.first.size() < o.keep)
+                        r.first.push_back(i);
+                }
+            }
+            if (ulps)
+                ulps[i] = d;
+        }
+    }
+}
+
+template <typename T>
+ulp_report_t<T> ulp_diff(span<const T> a, span<const T> b, const ulp_opts &o = {},
+    uint64_t *ulps = nullptr){
+    const size_t n = min(a.size(), b.size());
+    size_t t = o.threads ? o.threads : max(thread::hardware_concurrency(), 1u);
+    t = max<size_t>(min(t, n / (1 << 16)), 1);
+    vector<ulp_report_t<T>> parts(t);
+    vector<thread> threads;
+    for (size_t k = 0; k < t; k ++)
+        threads.emplace_back([&, k]{
+            ulp_diff_range(a.data(), b.data(), n * k / t, n * (k + 1) / t, o, ulps, parts[k]);
+        });
+    for (auto &th: threads)
+        th.join();
+    ulp_report_t<T> r;
+    for (auto &p: parts)
+        r.merge(p, o.keep);
+    return r;
+}
+
+template <typename T>
+ostream &operator<< (ostream &o, const ulp_report_t<T> &a){
+    o << a.n << " pairs, " << a.differ << " differ, max " << a.max_ulp << " ulp";
+    if (a.max_ulp)
+        o << " at " << a.max_at;
+    o << ", mean " << a.mean_ulp() << " ulp, NaN mismatches " << a.nan_mismatches
+      << ", +0/-0 " << a.zero_mismatches << endl;
+    o << "  ulp <=";
+    for (size_t k = 1; k < a.ulp_hist.size(); k ++)
+        if (a.ulp_hist[k])
+            o << " " << (k == 64 ? UINT64_MAX : (uint64_t(1) << k) - 1) << ":" << a.ulp_hist[k];
+    o << endl << "  bits";
+    for (size_t k = a.bit_flips.size(); k --; )
+        if (a.bit_flips[k])
+            o << " " << k << ":" << a.bit_flips[k];
+    o << endl << "  at";
+    for (size_t i: a.first)
+        o << " " << i;
+    return o << endl;
+}
 
 /*
  *    A use case for demo
@@ -157,5 +1292,64 @@ int main(){
 
     Double d = 3.14;
     cout << d.ieee754().get_e() << endl;
+
+    /*
+     *  Dump an array in hex with offsets, 4 bytes of an int in a group.
+     *  For a file, open it by ifstream f("a.bin", ios::binary), and then
+     *  dump_stream(f, cout).
+     */
+    int32_t v[] = {1, -1, 127, 65536, 3, 4, 5, 6};
+    dump(cout, span<const int32_t>(v), {.hex = true, .as_numbers = true, .offsets = true});
+
+    /*
+     *  Exponents of an array. How many would not fit in a format with 5 bits
+     *  of exponent, like FP16?
+     */
+    float f[] = {1.0f, -2.5f, 0.0f, 1e-40f, 1e30f, INFINITY, NAN, 3e-6f};
+    auto st = ieee754_stats(span<const float>(f));
+    cout << st << endl;
+    cout << st.overflows<fp16_desc>() << " overflows, " 
+         << st.underflows<fp16_desc>() << " underflows in FP16" << endl;
+
+    /*
+     *  1.2 in binary16 and in FP8 E4M3, rounded to the nearest. The mantissa 
+     *  is cut to 10 or 3 bits of 00110011001100110011010.
+     */
+    Half h(1.2);
+    cout << h.bytes << " " << h.ieee754().get_m() << " " << h.data << endl;
+    FP8E4M3 q(1.2);
+    cout << q.bytes << " " << q.ieee754().get_m() << " " << q.data << endl;
+
+    /*
+     *  Ten 3-bit flags in 30 bits of one word, the first one to the RIGHT.
+     */
+    uint8_t flags[] = {1, 2, 3, 4, 5, 6, 7, 0, 1, 2};
+    auto p = bit_packed_t::pack(span<const uint8_t>(flags));
+    cout << p.width() << " bits, " << bit_field<uint64_t, 30>(p.words()[0]) << ", " 
+         << p[6] << endl;
+
+    /*
+     *  Two arrays, as if from two builds of the same program.
+     */
+    float x1[] = {1.0f, 0.1f, -0.0f, NAN, 3.0f, 1e-45f};
+    float x2[] = {1.0f, 0.1f + 1e-8f, 0.0f, NAN, nextafter(3.0f, 4.0f), -1e-45f};
+    cout << ulp_diff(span<const float>(x1), span<const float>(x2));
+
+    /*
+     *  Whole arrays at a time. Clearing the sign bit of floats by & makes them
+     *  positive, and each element still shows its bits.
+     */
+    seqable_array<float> u = {1.5f, -2.0f, 3.25f}, w = {0.5f, 0.5f, -0.25f};
+    auto z = ((u + w) * 2.0f) & bit_cast<float>(0x7fffffffu);
+    cout << z << " " << (z > 4.0f) << " " << z[2].ieee754().get_e() << endl;
+
+    /*
+     *  A view of an array that is already there, which is halved in place, 
+     *  not copied. The bits of 0.5 are 00111111000000000000000000000000.
+     */
+    float raw[] = {1.0f, 3.0f, -8.0f};
+    seqable_array<float> r(raw);
+    r *= 0.5f;
+    cout << raw[0] << " " << raw[1] << " " << raw[2] << " " << r[0].bytes << endl;
     return 0;
 }
@@ -1,20 +1,129 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <algorithm>
+#include <utility>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 using namespace std;
 
+// Converted outputs of at least this many bytes are written around the cache
+size_t box_stream_bytes = size_t(32) << 20;
+
+// memcpy with non-temporal stores, so that a big copy does not flush the cache.
+// Call _mm_sfence() after the last one, before others may read dst.
+void *stream_copy(void *dst, const void *src, size_t n){
+#ifdef __SSE2__
+    char *d = (char*)dst;
+    const char *s = (const char*)src;
+    const size_t head = min(n, (16 - (uintptr_t)d % 16) % 16);
+    memcpy(d, s, head);
+    d += head, s += head, n -= head;
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)s);
+        __m128i x1 = _mm_loadu_si128((const __m128i*)s + 1);
+        __m128i x2 = _mm_loadu_si128((const __m128i*)s + 2);
+        __m128i x3 = _mm_loadu_si128((const __m128i*)s + 3);
+        _mm_stream_si128((__m128i*)d, x0);
+        _mm_stream_si128((__m128i*)d + 1, x1);
+        _mm_stream_si128((__m128i*)d + 2, x2);
+        _mm_stream_si128((__m128i*)d + 3, x3);
+    }
+    memcpy(d, s, n);
+    return dst;
+#else
+    return memcpy(dst, src, n);
+#endif
+}
+
+// memcpy of glibc already goes non-temporal for copies bigger than its cache share
 void *mbcopy(void *dst, const void *src, size_t dst_size, size_t src_size){
-    memcpy(dst, src,  ( src_size <= dst_size ) ? src_size : dst_size);
-    memset((byte*)dst + src_size, 0, ( src_size <= dst_size ) ? dst_size - src_size : 0);
+    const size_t n = ( src_size <= dst_size ) ? src_size : dst_size;
+    memcpy(dst, src, n);
+    memset((byte*)dst + n, 0, dst_size - n);
+    return dst;
+}
+
+// x as a D, or the nearest end of D's range if x is out of it. NaN gives 0
+// for integers, floating points keep NaN and infinities.
+template <typename D, typename S>
+D saturate_cast(S x){
+    if constexpr (is_floating_point_v<D> && is_floating_point_v<S> &&
+        (numeric_limits<S>::max() > numeric_limits<D>::max())) {
+        constexpr S hi = numeric_limits<D>::max(), inf = numeric_limits<S>::infinity();
+        return x > hi && x != inf ? numeric_limits<D>::max()
+            : x < -hi && x != -inf ? numeric_limits<D>::lowest() : D(x);
+    }
+    else if constexpr (is_same_v<D, bool> || is_same_v<S, bool> || is_floating_point_v<D>)
+        return D(x);
+    else if constexpr (is_floating_point_v<S>) {
+        // Both ends are powers of 2, or 0, or round up to one
+        constexpr S lo = S(numeric_limits<D>::min()), hi = S(numeric_limits<D>::max());
+        return x != x ? D(0) : x <= lo ? numeric_limits<D>::min()
+            : x >= hi ? numeric_limits<D>::max() : D(x);
+    }
+    else {
+        using DN = conditional_t<is_signed_v<D>, make_signed_t<D>, make_unsigned_t<D>>;
+        using SN = conditional_t<is_signed_v<S>, make_signed_t<S>, make_unsigned_t<S>>;
+        const SN v = SN(x);
+        return cmp_less(v, numeric_limits<DN>::min()) ? numeric_limits<D>::min()
+            : cmp_greater(v, numeric_limits<DN>::max()) ? numeric_limits<D>::max() : D(v);
+    }
+}
+
+// Written for compilers to vectorize, which g++ does at -O3
+template <typename D, typename S>
+void convert_n(D *__restrict d, const S *__restrict s, size_t n){
+    for (size_t i = 0; i < n; i ++)
+        d[i] = saturate_cast<D>(s[i]);
+}
+
+// Like mbcopy, but by elements. Big outputs are converted by blocks that stay in
+// L1, and then streamed out.
+template <typename D, typename S>
+void *mbconvert(D *dst, const S *src, size_t dst_n, size_t src_n){
+    const size_t n = min(dst_n, src_n);
+    if (n * sizeof(D) < box_stream_bytes)
+        convert_n(dst, src, n);
+    else {
+        alignas(64) D block[16384 / sizeof(D)];
+        const size_t m = sizeof(block) / sizeof(D);
+        for (size_t i = 0; i < n; i += m) {
+            const size_t k = min(m, n - i);
+            convert_n(block, src + i, k);
+            stream_copy(dst + i, block, k * sizeof(D));
+        }
+#ifdef __SSE2__
+        _mm_sfence();
+#endif
+    }
+    memset(dst + n, 0, (dst_n - n) * sizeof(D));
     return dst;
 }
 
 //Do you like a box?
+//Arithmetic arrays or values of another element type are converted element by
+//element. Other things, and raw(), copy the bytes.
 template <typename T>
 struct Box{
     T &data;
     template <typename H>
-    T &operator= (const H &a){ return *reinterpret_cast<T*>(mbcopy(&data, &a, sizeof(T), sizeof(H))); }
+    T &operator= (const H &a){
+        using D = remove_all_extents_t<T>;
+        using S = remove_cv_t<remove_all_extents_t<H>>;
+        if constexpr (is_arithmetic_v<D> && is_arithmetic_v<S> && !is_same_v<D, S>)
+            return *reinterpret_cast<T*>(mbconvert(reinterpret_cast<D*>(&data),
+                reinterpret_cast<const S*>(&a), sizeof(T) / sizeof(D), sizeof(H) / sizeof(S)));
+        else
+            return raw(a);
+    }
+    template <typename H>
+    T &raw (const H &a){ return *reinterpret_cast<T*>(mbcopy(&data, &a, sizeof(T), sizeof(H))); }
     operator T&(){return data;}
     T &operator()(){return data;}
 };
@@ -25,5 +134,19 @@ int main() {
     Box{a} = b; // We can not do a = b. But, we can do Box{a} = b;
     for (auto &p: a)
         cout << p << endl;
+    float f[] = {1.5f, -2.7f, 3e10f, NAN};
+    Box{a} = f; // 1, -2, 2147483647, 0
+    for (auto &p: a)
+        cout << p << endl;
+    int e[] = {-5, 100, 300};
+    unsigned char c[4];
+    Box{c} = e; // 0, 100, 255, 0
+    for (auto &p: c)
+        cout << int(p) << endl;
+    double g[] = {1e300, -1e300, INFINITY};
+    float h[3];
+    Box{h} = g; // 3.40282e+38, -3.40282e+38, inf
+    for (auto &p: h)
+        cout << p << endl;
     return 0;
 }
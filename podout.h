@@ -19,7 +19,10 @@
     The usage of this header is simple. 
     Step 1 - include the header.
     Step 2 - define your own POD structs.
-        No array member is allowed in the struct.
+        Array members, both C arrays and std::array, are allowed. They are
+        treated as one contiguous field. Multi-dimensional C arrays are seen
+        as a flat array of their elements, and an array of extent 1 can not 
+        be told from a scalar, but both have the same bytes anyway.
     Step 3 - use stream output operator to write all members to the stream
 
     You can explore this simple header yourself. It has some basic facilities 
@@ -35,6 +38,52 @@
     If you want to call static member functions of the class_t<T>, you need to 
     first call reflect<T>() or reflect(t), if t is an object of type T.
 
+    For array members, char arrays are written as bounded strings (up to the
+    first '\0', never past the end of the array), other arrays are written as 
+    a block, like [ 1 2 3 ]. The binary functions write_binary / read_binary 
+    write members one after another without padding, and each array member 
+    goes through one single write/read, not one call per element.
+
+    A scan_t<S> reads records straight from raw bytes, either an array of S in
+    memory (or a file mapped by mmap), or what write_binary wrote. You can pick
+    members by names or indices, filter rows by comparing members with some
+    constants, and only matching rows and picked members are copied out:
+
+        scan_t<student_t> sc(ptr, bytes);
+        sc.select("id", "score").where("gender", "==", 1);
+        sc.for_each([](const student_t &s){ ... });
+
+    Names are those set by set_member_names. Only arithmetic members and char
+    arrays can be compared. Integers compare by value, whatever their signs.
+
+    A packed_layout_t<S> is the padding free form of S for storage and network.
+    In declared order, it is the same as what write_binary writes. Members can 
+    also be reordered by their alignments. Records are packed and unpacked in 
+    spans, and report() tells how many bytes are saved for each record:
+
+        packed_layout_t<student_t> pl;
+        std::vector<char> buf(pl.size() * n);
+        pl.pack(std::span<const student_t>(students, n), buf.data());
+
+    A delta_codec_t<S> writes only what changed between two snapshots of the 
+    same array of S. Each changed record gets a bitmap of changed members and 
+    the packed bytes of these members. Unchanged records cost nothing. Records
+    can not be added or removed between two snapshots.
+
+        delta_codec_t<student_t> dc;
+        std::vector<char> d = dc.encode(old_students, new_students);
+        dc.apply(old_students, d);  // old_students is new_students now
+
+    Arrays of S can be sorted by one member, by names or indices, and grouped 
+    by it. Integer and floating point members use a stable LSD radix sort, 
+    where -0.0 comes before 0.0. Other members use std::stable_sort, char 
+    arrays and C strings are compared as strings, other arrays element by 
+    element, and other pointers can not be sorted by. Add -pthread for 
+    sort_mode::parallel:
+
+        sort_by(std::span<student_t>(students), "id");
+        for (auto g: group_by(std::span<student_t>(students), 3)) ...
+
     Again, this is just a toy for juniors. Do not expect too much.
 */
 
@@ -48,6 +97,15 @@
 #include <type_traits>
 #include <tuple>
 #include <array>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <vector>
+#include <functional>
+#include <span>
+#include <algorithm>
+#include <cstdint>
+#include <thread>
 
 template <typename S>
 constexpr auto reflect(const S &s = {});
@@ -71,6 +129,34 @@ concept is_stream_writable = requires (std::ostream &os, const T &a) {
 template <typename S, typename... Ts>
 concept is_aggregatable = requires (){ { S { Ts{}... } } -> std::same_as<S>; };
 
+// Contiguous fields: C arrays and std::array are both seen as N elements of E
+template <typename T>
+struct contiguous_traits{ static constexpr bool value = false; };
+
+template <typename E, size_t N>
+struct contiguous_traits<E[N]>{
+    static constexpr bool value = true;
+    using element_type = E;
+    static constexpr size_t extent = N;
+};
+
+template <typename E, size_t N>
+struct contiguous_traits<std::array<E, N>>{
+    static constexpr bool value = true;
+    using element_type = E;
+    static constexpr size_t extent = N;
+};
+
+template <typename T>
+concept is_contiguous_field = contiguous_traits<std::remove_cvref_t<T>>::value;
+
+template <typename T>
+concept is_char_field = is_contiguous_field<T> && std::is_same_v<char, 
+    std::remove_cv_t<typename contiguous_traits<
+        std::remove_cvref_t<T>
+    >::element_type>
+>;
+
 template<typename T>
 std::string typename_to_string(){
     std::string func_name = __PRETTY_FUNCTION__; 
@@ -150,7 +236,10 @@ struct save_member_type{
     friend auto constexpr member_ptr_type(member_tag_t<S, I>){ 
         return static_cast <M null_t<S>::* >(p);
     }
-    friend auto constexpr member_type(member_tag_t<S, I>){ return M{}; }
+    // Functions can not return arrays, so the type is wrapped.
+    friend auto constexpr member_type(member_tag_t<S, I>){ 
+        return std::type_identity<M>{}; 
+    }
 };
 // End: Friend injections
 
@@ -160,6 +249,85 @@ struct member_type_sequence: public BS{
     TM _v;
 };
 
+// Begin: Array member detection
+// When an aggregate is initialized by a flat list, brace elision hands each
+// array element to auto_t as if it were a member of its own. So the list of 
+// initializers is kept flat, with an array member U[k] repeated as k Us, while
+// the member list itself keeps U[k]. An array member is found by giving the
+// next member a braced list of two Us. A scalar or a struct refuses that. The
+// extent is then found by doubling and bisecting the length of the list.
+template <typename... Ts>
+struct type_list{};
+
+template <typename T, size_t>
+using repeat_t = T;
+
+template <typename L, typename... Ts>
+struct flat_push;
+
+template <typename... Fs>
+struct flat_push<type_list<Fs...>>{ using type = type_list<Fs...>; };
+
+template <typename... Fs, typename T, typename... Ts>
+struct flat_push<type_list<Fs...>, T, Ts...>{
+    using type = typename flat_push<type_list<Fs..., T>, Ts...>::type;
+};
+
+template <typename... Fs, typename E, size_t N, typename... Ts>
+struct flat_push<type_list<Fs...>, E[N], Ts...>{
+    template <size_t... ids>
+    static auto repeat(std::index_sequence<ids...>) -> 
+        type_list<Fs..., repeat_t<E, ids>...>;
+    using type = typename flat_push<
+        decltype(repeat(std::make_index_sequence<N>{})), Ts...
+    >::type;
+};
+
+template <typename S, typename L>
+struct flat_aggregate;
+
+template <typename S, typename... Fs>
+struct flat_aggregate<S, type_list<Fs...>>{
+    template <typename... Tail>
+    static constexpr bool accepts = is_aggregatable<S, Fs..., Tail...>;
+
+    template <typename... Tail>
+    static constexpr void make(Tail... t){ S { Fs{}..., t... }; }
+
+    template <typename U, size_t k>
+    static constexpr bool accepts_group = 
+        []<size_t... ids>(std::index_sequence<ids...>){
+            return requires (){ S { Fs{}..., { (void(ids), U{})... } }; };
+        }(std::make_index_sequence<k>{});
+
+    // accepts_group<U, lo> is true, accepts_group<U, hi> is false
+    template <typename U, size_t lo, size_t hi>
+    static constexpr size_t bisect(){
+        if constexpr (hi - lo <= 1)
+            return lo;
+        else if constexpr (accepts_group<U, (lo + hi) / 2>)
+            return bisect<U, (lo + hi) / 2, hi>();
+        else
+            return bisect<U, lo, (lo + hi) / 2>();
+    }
+
+    template <typename U, size_t k = 2>
+    static constexpr size_t extent_of(){
+        if constexpr (k == 2 && !accepts_group<U, 2>)
+            return 1;
+        else if constexpr (accepts_group<U, k * 2>)
+            return extent_of<U, k * 2>();
+        else
+            return bisect<U, k, k * 2>();
+    }
+};
+
+template <typename S, typename... Ts>
+using flat_aggregate_t = flat_aggregate<
+    S, typename flat_push<type_list<>, Ts...>::type
+>;
+// End: Array member detection
+
 template <typename S, size_t n = 0, typename B = null_t<S>, typename... Ts> 
     requires (std::is_trivial_v<B> && std::is_standard_layout_v<S>)
 struct auto_t{
@@ -176,7 +344,11 @@ struct auto_t{
         // The member_sequence object is trivial. All offsets are obtained by 
         // inheritence to construct a struct according to S. The member pointer
         // to each member is binary compatible to its offset.
-        using member_sequence = member_type_sequence<B, U>;
+        // If U is the first element of an array member, the member is U[k].
+        constexpr size_t k = flat_aggregate_t<S, Ts...>::template 
+            extent_of<U>();
+        using M = std::conditional_t<(k > 1), U[k], U>;
+        using member_sequence = member_type_sequence<B, M>;
         
         // This saves the n-th member of S by using pointer-to-member of 
         // member_sequence. 
@@ -184,24 +356,25 @@ struct auto_t{
         
         // Try construction incrementally, to iterate over all members of S 
         // recursively.
-        using next_t = auto_t<S, n + 1, member_sequence, Ts..., U>;
-        if constexpr (is_aggregatable<S, Ts..., U, next_t> )
+        using next_t = auto_t<S, n + 1, member_sequence, Ts..., M>;
+        using next_aggregate = flat_aggregate_t<S, Ts..., M>;
+        if constexpr (next_aggregate::template accepts<next_t>)
         // By instantiating S with more initilizers, we use the U() function to 
         // iterate over types of all S members.
-            S { Ts{}..., U{}, next_t{} };
+            next_aggregate::make(next_t{});
         else
         // When we are inside the last member's U(), we can save all types of
         // members of S by using friend injections. Below struct MUST be called 
         // in this way or using the sizeof() expression, so that causing friend
         // functions to be injected into the file scope.
-            save_class_type_as_tuple<S, std::tuple<Ts (S::*)..., U (S::*)> >{};
+            save_class_type_as_tuple<S, std::tuple<Ts (S::*)..., M (S::*)> >{};
         return U{};
     }
 };
 
 template <typename S, size_t I>
 struct member_t{
-    using type = decltype(member_type(member_tag_t<S, I>{}));
+    using type = typename decltype(member_type(member_tag_t<S, I>{}))::type;
     static constexpr type S::* ptr = scope_cast<S>(
         member_ptr_type(member_tag_t<S, I>{})
     );
@@ -210,6 +383,79 @@ struct member_t{
 template <typename S, size_t I>
 std::string member_t<S, I>::name;
 
+// Begin: Field input/output
+template <typename S>
+    requires (std::is_class_v<S> && 
+        std::is_standard_layout_v<S> && std::is_trivial_v<S>)
+std::ostream &operator<< (std::ostream &o, const S &a);
+
+template <typename S>
+    requires (std::is_class_v<S> && 
+        std::is_standard_layout_v<S> && std::is_trivial_v<S>)
+std::istream &operator>> (std::istream &i, S &a);
+
+template <typename S>
+std::ostream &write_binary(std::ostream &o, const S &a);
+
+template <typename S>
+std::istream &read_binary(std::istream &i, S &a);
+
+// A char array is a bounded string. It may fill the whole array without '\0'.
+template <typename T>
+void write_field(std::ostream &o, const T &v){
+    if constexpr (is_char_field<T>){
+        constexpr size_t N = contiguous_traits<T>::extent;
+        o.write(std::data(v), strnlen(std::data(v), N));
+    }
+    else if constexpr (is_contiguous_field<T>){
+        o << "[ ";
+        for (auto &e: v){
+            write_field(o, e);
+            o << ' ';
+        }
+        o << ']';
+    }
+    else if constexpr (is_stream_writable<T>)
+        o << v;
+}
+
+template <typename T>
+void read_field(std::istream &i, T &v){
+    if constexpr (is_char_field<T>){
+        constexpr size_t N = contiguous_traits<T>::extent;
+        std::string s;
+        i >> s;
+        size_t l = s.size() < N ? s.size() : N;
+        std::memcpy(std::data(v), s.data(), l);
+        std::memset(std::data(v) + l, 0, N - l);
+    }
+    else if constexpr (is_contiguous_field<T>){
+        for (auto &e: v)
+            read_field(i, e);
+    }
+    else if constexpr (is_stream_readable<T>)
+        i >> v;
+}
+
+// Nested structs are written member by member. Everything else, including 
+// whole arrays, goes in one single write of its bytes.
+template <typename T>
+void write_field_binary(std::ostream &o, const T &v){
+    if constexpr (std::is_class_v<T> && !is_contiguous_field<T>)
+        write_binary(o, v);
+    else
+        o.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+template <typename T>
+void read_field_binary(std::istream &i, T &v){
+    if constexpr (std::is_class_v<T> && !is_contiguous_field<T>)
+        read_binary(i, v);
+    else
+        i.read(reinterpret_cast<char *>(&v), sizeof(T));
+}
+// End: Field input/output
+
 template <typename S>
 struct class_t{
     class_t(const S &_o):_object(_o){ 
@@ -247,14 +493,10 @@ struct class_t{
     template <size_t n = 0, typename N = std::string>
     std::string get_member_by_name_as_str(const N &nx){
         if constexpr (n < member_count){
-            using member_type_as = decltype(_object.*std::get<n>(ptrs));
             if (member_t<S, n>::name == nx){
-                if constexpr (is_stream_writable < member_type_as >)
-                    return (std::stringstream() << (
-                        _object.*std::get<n>(ptrs)
-                    )).str();
-                else
-                    return "";
+                std::stringstream ss;
+                write_field(ss, _object.*std::get<n>(ptrs));
+                return ss.str();
             }
             return get_member_by_name_as_str<n + 1>(nx);
         }
@@ -269,10 +511,10 @@ struct class_t{
                 decltype(_object.*std::get<n>(ptrs))
             >;
             if (member_t<S, n>::name == nx) {
-                if constexpr ( is_stream_readable<member_type_mutable> )
-                    std::stringstream(s) >> const_cast<member_type_mutable&>(
-                        _object.*std::get<n>(ptrs)
-                    );
+                std::stringstream ss(s);
+                read_field(ss, const_cast<member_type_mutable&>(
+                    _object.*std::get<n>(ptrs)
+                ));
                 return;
             }
             set_member_by_name_from_str< n + 1 >(nx, s);
@@ -300,7 +542,7 @@ template <typename S>
     requires (std::is_class_v<S> && 
         std::is_standard_layout_v<S> && std::is_trivial_v<S>)
 std::ostream &operator<< (std::ostream &o, const S &a){
-    auto stream_out_action = [&](auto &p){ o << p << ' '; };
+    auto stream_out_action = [&](auto &p){ write_field(o, p); o << ' '; };
     o << "[ ";
     reflect(a).for_each(stream_out_action);
     o << ']';
@@ -311,12 +553,725 @@ template <typename S>
     requires (std::is_class_v<S> && 
         std::is_standard_layout_v<S> && std::is_trivial_v<S>)
 std::istream &operator>> (std::istream &i, S &a){
-    auto stream_in_action = [&](auto &p){ i >> p; };
-    reflect(a).for_each(stream_in_action);
+    reflect(a);
+    std::apply([&](auto... p){ (read_field(i, a.*p), ...); }, class_t<S>::ptrs);
+    return i;
+}
+
+// Members are written one after another, with no padding in between.
+template <typename S>
+std::ostream &write_binary(std::ostream &o, const S &a){
+    auto binary_out_action = [&](auto &p){ write_field_binary(o, p); };
+    reflect(a).for_each(binary_out_action);
+    return o;
+}
+
+template <typename S>
+std::istream &read_binary(std::istream &i, S &a){
+    reflect(a);
+    std::apply([&](auto... p){ 
+        (read_field_binary(i, a.*p), ...); 
+    }, class_t<S>::ptrs);
     return i;
 }
 // End: Seiralization operators
 
+// Begin: Record scanning
+// Offset of the n-th member in the natural image of S. S must be reflected.
+template <typename S, size_t n>
+size_t member_offset(){
+    static const S probe{};
+    return reinterpret_cast<const char *>(
+        &(probe.*std::get<n>(class_t<S>::ptrs))
+    ) - reinterpret_cast<const char *>(&probe);
+}
+
+// Memory versions of write_field_binary / read_field_binary
+template <typename T>
+size_t packed_size(){
+    if constexpr (std::is_class_v<T> && !is_contiguous_field<T>){
+        reflect<T>();
+        return std::apply([](auto... p){ 
+            return (packed_size<
+                std::remove_cvref_t<decltype(std::declval<T &>().*p)>
+            >() + ... + 0);
+        }, class_t<T>::ptrs);
+    }
+    else
+        return sizeof(T);
+}
+
+template <typename T>
+const char *load_field_binary(const char *src, T &v){
+    if constexpr (std::is_class_v<T> && !is_contiguous_field<T>){
+        reflect(v);
+        std::apply([&](auto... p){ 
+            ((src = load_field_binary(src, v.*p)), ...); 
+        }, class_t<T>::ptrs);
+        return src;
+    }
+    else {
+        std::memcpy(&v, src, sizeof(T));
+        return src + sizeof(T);
+    }
+}
+
+template <typename S>
+size_t member_index(size_t n){
+    if (n >= class_t<S>::member_count)
+        throw std::runtime_error("Member index out of range");
+    return n;
+}
+
+template <typename S>
+size_t member_index(const std::string &name){
+    for (size_t n = 0; n < class_t<S>::member_count; n ++)
+        if (class_t<S>::names[n] == name)
+            return n;
+    throw std::runtime_error("Unable to find member by name");
+}
+
+// Calls func with std::integral_constant<size_t, idx>
+template <typename S, typename F>
+void visit_member(size_t idx, F func){
+    [&]<size_t... ids>(std::index_sequence<ids...>){
+        ((ids == idx ? func(std::integral_constant<size_t, ids>{}) : void()), 
+            ...);
+    }(std::make_index_sequence<class_t<S>::member_count>{});
+}
+
+enum class record_layout{ natural, packed };
+
+enum class compare_op{ eq, ne, lt, le, gt, ge };
+
+inline compare_op compare_op_from_str(const std::string &op){
+    if (op == "==") return compare_op::eq;
+    if (op == "!=") return compare_op::ne;
+    if (op == "<")  return compare_op::lt;
+    if (op == "<=") return compare_op::le;
+    if (op == ">")  return compare_op::gt;
+    if (op == ">=") return compare_op::ge;
+    throw std::runtime_error("Unknown compare operator");
+}
+
+// Integers of the same width in a signed or unsigned form, for std::cmp_*
+template <typename T>
+using cmp_int_t = std::conditional_t<std::is_signed_v<T>, std::make_signed_t<T>, 
+    std::make_unsigned_t<T>>;
+
+// Integers are compared by value, so -1 is below any unsigned one
+template <typename A, typename B>
+bool compare_values(const A &a, compare_op op, const B &b){
+    if constexpr (std::is_integral_v<A> && std::is_integral_v<B> && 
+        !std::is_same_v<A, bool> && !std::is_same_v<B, bool>){
+        cmp_int_t<A> x = a;
+        cmp_int_t<B> y = b;
+        switch (op){
+            case compare_op::eq: return std::cmp_equal(x, y);
+            case compare_op::ne: return std::cmp_not_equal(x, y);
+            case compare_op::lt: return std::cmp_less(x, y);
+            case compare_op::le: return std::cmp_less_equal(x, y);
+            case compare_op::gt: return std::cmp_greater(x, y);
+            default:             return std::cmp_greater_equal(x, y);
+        }
+    }
+    else switch (op){
+        case compare_op::eq: return a == b;
+        case compare_op::ne: return a != b;
+        case compare_op::lt: return a < b;
+        case compare_op::le: return a <= b;
+        case compare_op::gt: return a > b;
+        default:             return a >= b;
+    }
+}
+
+template <typename S>
+struct scan_t{
+    using row_test = std::function<bool (const char *)>;
+
+    scan_t(const void *data, size_t bytes, 
+        record_layout layout = record_layout::natural)
+        :_data(static_cast<const char *>(data)), _layout(layout){
+        reflect<S>();
+        _offsets.resize(member_count);
+        init_fields(std::make_index_sequence<member_count>{});
+        _stride = (layout == record_layout::natural) ? sizeof(S) : _offsets[
+            member_count - 1] + packed_size<member_type<member_count - 1>>();
+        _rows = bytes / _stride;
+        for (size_t n = 0; n < member_count; n ++)
+            _selected.push_back(n);
+    }
+
+    // Members to be copied out, by names or indices. All, if never called.
+    template <typename... Ms>
+    scan_t &select(const Ms &... ms){
+        _selected.clear();
+        (_selected.push_back(member_index<S>(ms)), ...);
+        return *this;
+    }
+
+    // Keep rows whose member m compares to the constant v, like "math" > 90.
+    template <typename M, typename V>
+    scan_t &where(const M &m, const std::string &op, const V &v){
+        compare_op cop = compare_op_from_str(op);
+        visit_member<S>(member_index<S>(m), [&](auto n){ 
+            add_test<n>(cop, v); 
+        });
+        return *this;
+    }
+
+    size_t rows() const { return _rows; }
+
+    size_t count() const {
+        size_t c = 0;
+        for (size_t r = 0; r < _rows; r ++)
+            c += match(_data + r * _stride);
+        return c;
+    }
+
+    // func gets an S, in which only selected members are filled.
+    template <typename F>
+    size_t for_each(F func) const {
+        size_t c = 0;
+        for (size_t r = 0; r < _rows; r ++){
+            const char *rec = _data + r * _stride;
+            if (!match(rec))
+                continue;
+            S row{};
+            for (size_t n: _selected)
+                _loaders[n](rec + _offsets[n], row);
+            func(static_cast<const S &>(row));
+            c ++;
+        }
+        return c;
+    }
+
+    std::vector<S> collect() const {
+        std::vector<S> r;
+        for_each([&](const S &row){ r.push_back(row); });
+        return r;
+    }
+
+private:
+    static constexpr size_t member_count = class_t<S>::member_count;
+
+    template <size_t n>
+    using member_type = typename member_t<S, n>::type;
+
+    template <size_t n>
+    static void load_natural(const char *src, S &dst){
+        std::memcpy(&(dst.*std::get<n>(class_t<S>::ptrs)), src, 
+            sizeof(member_type<n>));
+    }
+
+    template <size_t n>
+    static void load_packed(const char *src, S &dst){
+        load_field_binary(src, dst.*std::get<n>(class_t<S>::ptrs));
+    }
+
+    template <size_t... ids>
+    void init_fields(std::index_sequence<ids...>){
+        if (_layout == record_layout::natural){
+            _offsets = { member_offset<S, ids>()... };
+            _loaders = { &load_natural<ids>... };
+        }
+        else {
+            size_t sizes[] = { packed_size<member_type<ids>>()... };
+            for (size_t n = 0, o = 0; n < member_count; o += sizes[n ++])
+                _offsets[n] = o;
+            _loaders = { &load_packed<ids>... };
+        }
+    }
+
+    // Values are read from raw bytes, records may not be aligned.
+    template <size_t n, typename V>
+    void add_test(compare_op op, const V &v){
+        using M = member_type<n>;
+        size_t off = _offsets[n];
+        // A floating point member is compared with the value in its own type,
+        // so that a float is equal to 0.1 if it was set to 0.1
+        if constexpr (std::is_floating_point_v<M> && std::is_arithmetic_v<V>){
+            const M b = static_cast<M>(v);
+            _tests.push_back([=](const char *rec){
+                M a;
+                std::memcpy(&a, rec + off, sizeof(M));
+                return compare_values(a, op, b);
+            });
+        }
+        else if constexpr (std::is_arithmetic_v<M> && std::is_arithmetic_v<V>)
+            _tests.push_back([=](const char *rec){
+                M a;
+                std::memcpy(&a, rec + off, sizeof(M));
+                return compare_values(a, op, v);
+            });
+        else if constexpr (is_char_field<M> && 
+            std::is_convertible_v<const V &, std::string_view>){
+            std::string b{std::string_view(v)};
+            _tests.push_back([=](const char *rec){
+                std::string_view a(rec + off, strnlen(rec + off, sizeof(M)));
+                return compare_values(a, op, std::string_view(b));
+            });
+        }
+        else
+            throw std::runtime_error("Unable to compare member with value");
+    }
+
+    bool match(const char *rec) const {
+        for (auto &t: _tests)
+            if (!t(rec))
+                return false;
+        return true;
+    }
+
+    const char *_data;
+    record_layout _layout;
+    size_t _stride = 0;
+    size_t _rows = 0;
+    std::vector<size_t> _offsets;
+    std::vector<void (*)(const char *, S &)> _loaders;
+    std::vector<size_t> _selected;
+    std::vector<row_test> _tests;
+};
+// End: Record scanning
+
+// Begin: Packed layout
+// One memcpy of a packed record: size bytes from natural offset to packed 
+// offset. Neighbour fields with no padding between them share one copy.
+struct copy_op_t{
+    size_t natural;
+    size_t packed;
+    size_t size;
+};
+
+// Natural offsets and sizes of all non-struct fields, nested structs unfolded
+template <typename T>
+void append_leaves(size_t base, std::vector<copy_op_t> &ops){
+    if constexpr (std::is_class_v<T> && !is_contiguous_field<T>){
+        reflect<T>();
+        [&]<size_t... ids>(std::index_sequence<ids...>){
+            (append_leaves<typename member_t<T, ids>::type>(
+                base + member_offset<T, ids>(), ops
+            ), ...);
+        }(std::make_index_sequence<class_t<T>::member_count>{});
+    }
+    else
+        ops.push_back({base, 0, sizeof(T)});
+}
+
+// Fields of each member of S, in declared order
+template <typename S>
+std::vector<std::vector<copy_op_t>> member_leaves(){
+    reflect<S>();
+    std::vector<std::vector<copy_op_t>> r(class_t<S>::member_count);
+    [&]<size_t... ids>(std::index_sequence<ids...>){
+        (append_leaves<typename member_t<S, ids>::type>(
+            member_offset<S, ids>(), r[ids]
+        ), ...);
+    }(std::make_index_sequence<class_t<S>::member_count>{});
+    return r;
+}
+
+enum class packed_order{ declared, by_alignment };
+
+template <typename S>
+struct packed_layout_t{
+    packed_layout_t(packed_order order = packed_order::declared){
+        reflect<S>();
+        auto leaves = member_leaves<S>();
+        constexpr size_t member_count = class_t<S>::member_count;
+        std::array<size_t, member_count> aligns;
+        [&]<size_t... ids>(std::index_sequence<ids...>){
+            aligns = { alignof(member_type<ids>)... };
+        }(std::make_index_sequence<member_count>{});
+
+        for (size_t n = 0; n < member_count; n ++)
+            _order.push_back(n);
+        if (order == packed_order::by_alignment)
+            std::stable_sort(_order.begin(), _order.end(), 
+                [&](size_t a, size_t b){ return aligns[a] > aligns[b]; });
+
+        for (size_t n: _order)
+            for (auto op: leaves[n]){
+                op.packed = _size;
+                _size += op.size;
+                if (!_ops.empty() && 
+                    _ops.back().natural + _ops.back().size == op.natural)
+                    _ops.back().size += op.size;
+                else
+                    _ops.push_back(op);
+            }
+    }
+
+    size_t size() const { return _size; }
+    size_t saved() const { return sizeof(S) - _size; }
+    const std::vector<size_t> &order() const { 
+        return _order; 
+    }
+
+    // dst must have size() * src.size() bytes. Returns the end of the output.
+    char *pack(std::span<const S> src, char *dst) const {
+        for (const S &r: src){
+            const char *rec = reinterpret_cast<const char *>(&r);
+            for (auto &op: _ops)
+                std::memcpy(dst + op.packed, rec + op.natural, op.size);
+            dst += _size;
+        }
+        return dst;
+    }
+
+    std::vector<char> pack(std::span<const S> src) const {
+        std::vector<char> r(_size * src.size());
+        pack(src, r.data());
+        return r;
+    }
+
+    // Padding bytes in dst are left untouched.
+    const char *unpack(const char *src, std::span<S> dst) const {
+        for (S &r: dst){
+            char *rec = reinterpret_cast<char *>(&r);
+            for (auto &op: _ops)
+                std::memcpy(rec + op.natural, src + op.packed, op.size);
+            src += _size;
+        }
+        return src;
+    }
+
+    std::ostream &report(std::ostream &o) const {
+        return o << typename_to_string<S>() << ": " << sizeof(S) << " -> " 
+            << _size << " bytes, " << saved() << " saved";
+    }
+
+private:
+    template <size_t n>
+    using member_type = typename member_t<S, n>::type;
+
+    std::vector<size_t> _order;
+    std::vector<copy_op_t> _ops;
+    size_t _size = 0;
+};
+// End: Packed layout
+
+// Begin: Delta encoding
+// A delta is a list of changed records. Each one is written as:
+//     the gap to the last changed record (varint), 
+//     a bitmap of changed members (one bit for each member), 
+//     packed bytes of all changed members.
+inline void put_varint(std::vector<char> &out, size_t v){
+    for (; v >= 0x80; v >>= 7)
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    out.push_back(static_cast<char>(v));
+}
+
+inline const char *get_varint(const char *p, const char *end, size_t &v){
+    v = 0;
+    for (size_t s = 0; p < end && s < 64; s += 7){
+        uint8_t b = static_cast<uint8_t>(*p ++);
+        v |= size_t(b & 0x7f) << s;
+        if (!(b & 0x80))
+            return p;
+    }
+    throw std::runtime_error("Broken delta");
+}
+
+template <typename S>
+struct delta_codec_t{
+    delta_codec_t():_members(member_leaves<S>()), 
+        _bitmap_size((_members.size() + 7) / 8){}
+
+    // Appends the delta from base to cur to out
+    void encode(std::span<const S> base, std::span<const S> cur, 
+        std::vector<char> &out) const {
+        if (base.size() != cur.size())
+            throw std::runtime_error("Snapshots of different sizes");
+        size_t last = 0;
+        for (size_t r = 0; r < cur.size(); r ++){
+            const char *a = reinterpret_cast<const char *>(&base[r]);
+            const char *b = reinterpret_cast<const char *>(&cur[r]);
+            if (!std::memcmp(a, b, sizeof(S)))
+                continue;
+            size_t head = out.size();
+            bool changed = false;
+            put_varint(out, r - last);
+            size_t bitmap = out.size();
+            out.resize(bitmap + _bitmap_size);
+            for (size_t m = 0; m < _members.size(); m ++){
+                if (same(_members[m], a, b))
+                    continue;
+                out[bitmap + m / 8] |= char(1 << (m % 8));
+                for (auto &op: _members[m])
+                    out.insert(out.end(), b + op.natural, 
+                        b + op.natural + op.size);
+                changed = true;
+            }
+            // Only padding bytes differ
+            if (!changed)
+                out.resize(head);
+            else
+                last = r;
+        }
+    }
+
+    std::vector<char> encode(std::span<const S> base, 
+        std::span<const S> cur) const {
+        std::vector<char> r;
+        encode(base, cur, r);
+        return r;
+    }
+
+    void apply(std::span<S> base, const char *data, size_t size) const {
+        const char *end = data + size;
+        size_t r = 0;
+        while (data < end){
+            size_t gap;
+            data = get_varint(data, end, gap);
+            r += gap;
+            if (r >= base.size() || size_t(end - data) < _bitmap_size)
+                throw std::runtime_error("Broken delta");
+            const char *bitmap = data;
+            data += _bitmap_size;
+            char *rec = reinterpret_cast<char *>(&base[r]);
+            for (size_t m = 0; m < _members.size(); m ++){
+                if (!(bitmap[m / 8] & (1 << (m % 8))))
+                    continue;
+                for (auto &op: _members[m]){
+                    if (size_t(end - data) < op.size)
+                        throw std::runtime_error("Broken delta");
+                    std::memcpy(rec + op.natural, data, op.size);
+                    data += op.size;
+                }
+            }
+        }
+    }
+
+    void apply(std::span<S> base, const std::vector<char> &delta) const {
+        apply(base, delta.data(), delta.size());
+    }
+
+private:
+    static bool same(const std::vector<copy_op_t> &ops, 
+        const char *a, const char *b){
+        for (auto &op: ops)
+            if (std::memcmp(a + op.natural, b + op.natural, op.size))
+                return false;
+        return true;
+    }
+
+    std::vector<std::vector<copy_op_t>> _members;
+    size_t _bitmap_size;
+};
+// End: Delta encoding
+
+// Begin: Sorting and grouping
+enum class sort_mode{ serial, parallel };
+
+template <typename M>
+concept is_radix_key = (std::is_integral_v<M> || std::is_floating_point_v<M>)
+    && sizeof(M) <= 8;
+
+template <size_t n> struct uint_of_size;
+template <> struct uint_of_size<1>{ using type = uint8_t; };
+template <> struct uint_of_size<2>{ using type = uint16_t; };
+template <> struct uint_of_size<4>{ using type = uint32_t; };
+template <> struct uint_of_size<8>{ using type = uint64_t; };
+
+// Map a value to an unsigned integer with the same order. Signed integers get
+// the sign bit flipped. Negative floats get all bits flipped, others the sign.
+template <is_radix_key M>
+auto radix_key(const M &v){
+    using K = typename uint_of_size<sizeof(M)>::type;
+    constexpr K top = K(K(1) << (sizeof(M) * 8 - 1));
+    K k;
+    std::memcpy(&k, &v, sizeof(M));
+    if constexpr (std::is_floating_point_v<M>)
+        return (k & top) ? K(~k) : K(k | top);
+    else if constexpr (std::is_signed_v<M>)
+        return K(k ^ top);
+    else
+        return k;
+}
+
+inline size_t sort_threads(sort_mode mode, size_t n){
+    size_t t = (mode == sort_mode::parallel) ? 
+        std::max(1u, std::thread::hardware_concurrency()) : 1;
+    // Small chunks are not worth a thread
+    return std::max<size_t>(1, std::min(t, n / 65536));
+}
+
+inline void run_threads(size_t t, const std::function<void (size_t)> &func){
+    if (t == 1)
+        return func(0);
+    std::vector<std::thread> ts;
+    for (size_t i = 0; i < t; i ++)
+        ts.emplace_back(func, i);
+    for (auto &th: ts)
+        th.join();
+}
+
+template <typename K>
+struct keyed_t{
+    K key;
+    size_t id;
+};
+
+// One pass for each byte of the key. A pass is skipped if all keys have the 
+// same byte there. Each thread counts and scatters its own chunk, and chunks
+// are placed in order, so it is stable in both modes.
+template <typename K>
+void radix_sort(std::vector<keyed_t<K>> &v, size_t threads){
+    size_t n = v.size(), chunk = (n + threads - 1) / threads;
+    std::vector<keyed_t<K>> tmp(n);
+    std::vector<std::array<size_t, 256>> counts(threads);
+    for (size_t shift = 0; shift < sizeof(K) * 8; shift += 8){
+        run_threads(threads, [&](size_t t){
+            counts[t].fill(0);
+            for (size_t i = t * chunk; i < std::min(n, (t + 1) * chunk); i ++)
+                counts[t][(v[i].key >> shift) & 0xff] ++;
+        });
+        size_t total[256] = {};
+        for (auto &c: counts)
+            for (size_t d = 0; d < 256; d ++)
+                total[d] += c[d];
+        if (std::count(total, total + 256, 0) == 255)
+            continue;
+        for (size_t d = 0, o = 0; d < 256; d ++)
+            for (auto &c: counts){
+                size_t k = c[d];
+                c[d] = o;
+                o += k;
+            }
+        run_threads(threads, [&](size_t t){
+            for (size_t i = t * chunk; i < std::min(n, (t + 1) * chunk); i ++)
+                tmp[counts[t][(v[i].key >> shift) & 0xff] ++] = v[i];
+        });
+        v.swap(tmp);
+    }
+}
+
+// Sorted chunks are merged in pairs, each level of merges runs in threads.
+template <typename S, typename L>
+void merge_sort(std::span<S> r, L less, size_t threads){
+    size_t n = r.size(), chunk = (n + threads - 1) / threads;
+    run_threads(threads, [&](size_t t){
+        std::stable_sort(r.begin() + std::min(n, t * chunk), 
+            r.begin() + std::min(n, (t + 1) * chunk), less);
+    });
+    for (size_t w = chunk; w < n; w *= 2)
+        run_threads((n + 2 * w - 1) / (2 * w), [&](size_t t){
+            size_t b = t * 2 * w;
+            std::inplace_merge(r.begin() + b, r.begin() + std::min(n, b + w), 
+                r.begin() + std::min(n, b + 2 * w), less);
+        });
+}
+
+template <typename T>
+concept is_c_string = std::is_same_v<T, const char *> || std::is_same_v<T, char *>;
+
+// Other C arrays of one rank are compared element by element, like std::array
+template <typename T>
+concept is_ordered_array = std::rank_v<T> == 1 && 
+    std::totally_ordered<std::remove_extent_t<T>> && 
+    !std::is_pointer_v<std::remove_extent_t<T>>;
+
+// C strings by their text, with null ones first
+inline int compare_c_strings(const char *a, const char *b){
+    if (!a || !b)
+        return (a != nullptr) - (b != nullptr);
+    return std::strcmp(a, b);
+}
+
+template <typename S, size_t n>
+void sort_by_member(std::span<S> r, sort_mode mode){
+    using M = typename member_t<S, n>::type;
+    constexpr auto p = std::get<n>(class_t<S>::ptrs);
+    size_t threads = sort_threads(mode, r.size());
+    if constexpr (is_radix_key<M>){
+        using K = decltype(radix_key(M{}));
+        std::vector<keyed_t<K>> keys(r.size());
+        for (size_t i = 0; i < r.size(); i ++)
+            keys[i] = { radix_key(r[i].*p), i };
+        radix_sort(keys, threads);
+        std::vector<S> sorted(r.size());
+        for (size_t i = 0; i < r.size(); i ++)
+            sorted[i] = r[keys[i].id];
+        std::copy(sorted.begin(), sorted.end(), r.begin());
+    }
+    else if constexpr (is_char_field<M>)
+        merge_sort(r, [](const S &a, const S &b){
+            return std::string_view(std::data(a.*p), strnlen(std::data(a.*p), 
+                sizeof(M))) < std::string_view(std::data(b.*p), 
+                strnlen(std::data(b.*p), sizeof(M)));
+        }, threads);
+    else if constexpr (is_c_string<M>)
+        merge_sort(r, [](const S &a, const S &b){ 
+            return compare_c_strings(a.*p, b.*p) < 0; 
+        }, threads);
+    else if constexpr (is_ordered_array<M>)
+        merge_sort(r, [](const S &a, const S &b){
+            return std::lexicographical_compare(std::begin(a.*p), std::end(a.*p),
+                std::begin(b.*p), std::end(b.*p));
+        }, threads);
+    // Other pointers and arrays would be sorted by their addresses
+    else if constexpr (std::totally_ordered<M> && !std::is_pointer_v<M> && 
+        !std::is_array_v<M>)
+        merge_sort(r, [](const S &a, const S &b){ return a.*p < b.*p; }, 
+            threads);
+    else
+        throw std::runtime_error("Unable to sort by member");
+}
+
+template <typename S, size_t n>
+bool same_member(const S &a, const S &b){
+    using M = typename member_t<S, n>::type;
+    constexpr auto p = std::get<n>(class_t<S>::ptrs);
+    if constexpr (is_radix_key<M>)
+        return radix_key(a.*p) == radix_key(b.*p);
+    else if constexpr (is_char_field<M>)
+        return std::strncmp(std::data(a.*p), std::data(b.*p), sizeof(M)) == 0;
+    else if constexpr (is_c_string<M>)
+        return compare_c_strings(a.*p, b.*p) == 0;
+    else if constexpr (is_ordered_array<M>)
+        return std::equal(std::begin(a.*p), std::end(a.*p), std::begin(b.*p), 
+            [](const auto &x, const auto &y){ return !(x < y) && !(y < x); });
+    else if constexpr (!std::is_array_v<M>)
+        return !(a.*p < b.*p) && !(b.*p < a.*p);
+    else
+        throw std::runtime_error("Unable to compare member");
+}
+
+// Member m is given by its name or its index
+template <typename S, typename M>
+void sort_by(std::span<S> r, const M &m, sort_mode mode = sort_mode::serial){
+    reflect<S>();
+    visit_member<S>(member_index<S>(m), [&](auto n){ 
+        sort_by_member<S, n>(r, mode); 
+    });
+}
+
+// Sorts r by member m, and returns runs of records with equal m
+template <typename S, typename M>
+std::vector<std::span<S>> group_by(std::span<S> r, const M &m, 
+    sort_mode mode = sort_mode::serial){
+    reflect<S>();
+    std::vector<std::span<S>> groups;
+    visit_member<S>(member_index<S>(m), [&](auto n){
+        using T = typename member_t<S, n>::type;
+        if constexpr (!is_radix_key<T> && !is_char_field<T> && 
+            !is_ordered_array<T> && 
+            !(std::totally_ordered<T> && !std::is_array_v<T>))
+            throw std::runtime_error("Unable to group by member");
+        else {
+            sort_by_member<S, n>(r, mode);
+            for (size_t b = 0, e = 0; b < r.size(); b = e){
+                for (e = b + 1; e < r.size() && 
+                    same_member<S, n>(r[b], r[e]); e ++);
+                groups.push_back(r.subspan(b, e - b));
+            }
+        }
+    });
+    return groups;
+}
+// End: Sorting and grouping
+
 template <typename S>
 constexpr auto reflect(const S &s){
     if (!is_reflected< S >)
@@ -0,0 +1,80 @@
+/*
+ * podout_sort.cpp - Checking sort_by and group_by of podout.h
+ *     Author: Dr. Pu-Feng Du (2025)
+ *     Random records are sorted by an integer, a C string and a float array
+ *     member, serially and on threads, and compared with std::stable_sort.
+ *     Runs of equal arrays must be the groups of group_by. Arrays of structs
+ *     without operator< must be refused, not sorted by their addresses. This
+ *     needs C++20 and -pthread.
+ */
+#include <iostream>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "podout.h"
+using namespace std;
+
+struct pt{
+    int x, y;
+};
+
+struct rec_t{
+    int id;
+    const char *name;
+    float score[3];
+    pt pts[2];
+};
+
+template <typename L>
+bool sorted_like(vector<rec_t> v, size_t member, sort_mode mode, L less){
+    vector<rec_t> w = v;
+    sort_by(span<rec_t>(v), member, mode);
+    stable_sort(w.begin(), w.end(), less);
+    for (size_t i = 0; i < v.size(); i ++)
+        if (v[i].id != w[i].id)
+            return false;
+    return true;
+}
+
+int main(){
+    const char *names[] = {"carol", "alice", nullptr, "bob"};
+    const size_t rows = 100000;
+    mt19937 g(2025);
+    vector<rec_t> recs(rows);
+    for (size_t r = 0; r < rows; r ++)
+        recs[r] = { int(g() % 1000), names[g() % 4],
+            { float(g() % 3), float(g() % 3), float(g() % 3) },
+            { { int(g()), int(g()) }, { int(g()), int(g()) } } };
+    auto by_score = [](const rec_t &a, const rec_t &b){
+        return lexicographical_compare(begin(a.score), end(a.score),
+            begin(b.score), end(b.score));
+    };
+    for (sort_mode mode: {sort_mode::serial, sort_mode::parallel}){
+        bool ok = sorted_like(recs, 0, mode, [](const rec_t &a, const rec_t &b){
+            return a.id < b.id;
+        });
+        ok &= sorted_like(recs, 1, mode, [](const rec_t &a, const rec_t &b){
+            return compare_c_strings(a.name, b.name) < 0;
+        });
+        ok &= sorted_like(recs, 2, mode, by_score);
+        cout << (mode == sort_mode::serial ? "serial sorts:        " : "parallel sorts:      ")
+             << (ok ? "same results" : "DIFFERENT results") << endl;
+    }
+
+    vector<rec_t> v = recs;
+    auto groups = group_by(span<rec_t>(v), 2);
+    bool ok = groups.size() == 27;
+    for (auto gr: groups)
+        for (auto &x: gr)
+            ok &= equal(begin(x.score), end(x.score), begin(gr[0].score));
+    cout << "groups of score:     " << groups.size() << ", "
+         << (ok ? "same arrays" : "DIFFERENT arrays") << endl;
+
+    string what = "no error";
+    try { sort_by(span<rec_t>(v), 3); } catch (exception &e){ what = e.what(); }
+    cout << "sort by pts:         " << what << endl;
+    what = "no error";
+    try { group_by(span<rec_t>(v), 3); } catch (exception &e){ what = e.what(); }
+    cout << "group by pts:        " << what << endl;
+    return 0;
+}
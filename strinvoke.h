@@ -39,6 +39,70 @@
     4 use the function ibsCall to invoke your function, like
         ibsCall ({"foo", "15", "15.5"});
     ibsCall will also return the return value of your function as a string.
+    5 if you do not like to create strings for every call, there is another form
+        string_view args[] = {"foo", "15", "15.5"};
+        char out[64];
+        size_t n = ibsCall(args, out, sizeof(out)); // result in out[0..n)
+    Arithmetic types are parsed by from_chars and written by to_chars in this 
+    form, others still go through streams. The output looks the same as the 
+    string form.
+    6 when all functions are exported, you may freeze the registry by 
+        ibsBase::ibsFunctions.freeze();
+    Names are then found by a perfect hash, and no more function can be added.
+    If you call a function many times, keep a handle to skip the lookups:
+        ibsHandle foo_h = ibsResolve("foo");
+        foo_h({"15", "15.5"});
+    7 to call a function on many rows of arguments, use ibsBatchCall. Rows are
+    given in a row-major block or in columns. Results go to fixed-size slots
+    of a buffer, row r at out + r * slot, with its length in lens[r]. If the 
+    function is exported by export_concurrent_function, rows are shared by 
+    threads of an ibsThreadPool, otherwise they are called one by one.
+        ibsThreadPool pool;
+        ibsBatchCall("foo", ibsBatchArgs(cells, 2), out, 32, lens, &pool);
+    See strinvoke_bench.cpp for a full example.
+    8 to serve commands line by line, like "foo 15 15.5", use an ibsServer. 
+    Arguments are split by spaces, an argument with spaces may be quoted like
+    "1 2". Each command gets one line of result, or "ERROR: what" if it fails.
+        ibsServer().serve(ibsStreamReader(cin), ibsStreamWriter(cout));
+    Reading and splitting, calling, and writing run in their own threads, so 
+    they overlap. With workers > 1, batches of commands run out of order, but
+    results are still written in order. On POSIX systems, there are also 
+    ibsServeFd for files or pipes, and ibsServeUnix for Unix domain sockets.
+    9 if a function is pure, export it by export_cached_function(foo, 1024). 
+    Results of the last calls, at most 1024, are remembered. A call with the 
+    same arguments (spaces around them do not count) gets the result without 
+    parsing arguments or calling foo. Pure functions are also assumed to be 
+    safe for concurrent calls. Counters are there in ibsCacheStatus("foo").
+    10 define STR_INVOKE_METRICS before including this header to count calls
+    and errors of each function, and to time how long its arguments are 
+    parsed, how long it runs and how long its result is written. Each thread
+    counts for itself, and counts are added up when you read them by 
+    ibsMetrics("foo"), or print them all by ibsDumpMetrics(cout). Without 
+    STR_INVOKE_METRICS, nothing is counted and nothing is slowed down.
+    11 a script of calls can be compiled once into an ibsPlan and run many 
+    times. Functions are found once, constant arguments are parsed once, and
+    results go to later calls as typed values, not strings. "x = foo 1 2" 
+    keeps the result of foo as $x, and $0, $1, ... are the inputs of run().
+        ibsPlan plan("x = foo 15 $0\nbar $x $x");
+        plan.run({"15.5"});
+        cout << plan.result() << plan.value<int>("x");
+    12 ibsCallAsync runs a call on the threads of an ibsExecutor and returns a
+    future of the result. In a coroutine, co_await ibsAwaitCall(...) instead,
+    and the coroutine goes on in the thread that made the call. 
+        future<string> r = ibsCallAsync({"foo", "15", "15.5"});
+        string s = co_await ibsAwaitCall({"foo", "15", "15.5"});
+    The queue of an executor is bounded. When it is full, a new call waits for
+    room, runs in the calling thread, or is rejected, as set in its options.
+    13 if the caller holds typed values, strings can be skipped. Arguments are
+    packed as binary, and the result comes back as binary.
+        string args = ibsPackArgs(15, 15.5f);
+        char out[64];
+        size_t n = ibsCallBinary("foo", args, out, sizeof(out));
+        int r = ibsUnpackResult<int>(out, n);
+    Each value is a 4-byte length and its bytes. Trivially copyable types are
+    their bytes in memory, strings, string_views, char arrays and C strings
+    are their chars up to the NUL, others are their text by
+    << and >>. Only peers of the same byte order and type sizes may talk so.
 
     Oh, we need C++20. Please update your compiler, if you had not.
 
@@ -50,6 +114,39 @@
 #include <sstream>
 #include <vector>
 #include <unordered_map>
+#include <span>
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <cctype>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <array>
+#include <cstdint>
+#include <chrono>
+#include <bit>
+#include <iomanip>
+#include <typeinfo>
+#include <initializer_list>
+#include <future>
+#include <coroutine>
+#include <map>
+#include <istream>
+#include <ostream>
+#if __has_include(<sys/socket.h>) && __has_include(<sys/un.h>) && __has_include(<unistd.h>)
+#define __STR_INVOKE_POSIX__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 using namespace std;
 
@@ -83,75 +180,1691 @@ const string ToString(const T &o) {
     return ss.str();
 }
 
+// Converting without stringstream. Arithmetic types use from_chars/to_chars, 
+// others fall back to streams. Behave like >> and << as much as possible, i.e.
+// leading spaces and '+' are skipped, and numbers stop at the first bad char.
+// Floating points are written like "%g", which is the default of ostream.
+// Character types, like int8_t and uint8_t, are one char, not a number.
+template <typename T>
+concept ibsCharType = is_same_v<remove_cv_t<T>, char> || 
+    is_same_v<remove_cv_t<T>, signed char> || 
+    is_same_v<remove_cv_t<T>, unsigned char> || 
+    is_same_v<remove_cv_t<T>, char8_t>;
+
+template <Streamable_in T>
+T FromChars(string_view s){
+    if constexpr (is_same_v<T, bool> || ibsCharType<T>) 
+        return FromString<T>(string(s));
+    else if constexpr (is_arithmetic_v<T>){
+        const char *b = s.data(), *e = s.data() + s.size();
+        while (b < e && isspace(static_cast<unsigned char>(*b)))
+            b ++;
+        if (b < e && *b == '+')
+            b ++;
+        T r{};
+        from_chars(b, e, r);
+        return r;
+    }
+    else
+        return FromString<T>(string(s));
+}
+
+template <Streamable_out T>
+size_t ToChars(const T &o, char *out, size_t size){
+    to_chars_result r{out, errc{}};
+    if constexpr (is_same_v<T, bool>)
+        r = to_chars(out, out + size, int(o));
+    else if constexpr (ibsCharType<T>){
+        if (size < 1)
+            r.ec = errc::value_too_large;
+        else
+            *r.ptr ++ = o;
+    }
+    else if constexpr (is_floating_point_v<T>)
+        r = to_chars(out, out + size, o, chars_format::general, 6);
+    else if constexpr (is_arithmetic_v<T>)
+        r = to_chars(out, out + size, o);
+    else {
+        const string s = ToString(o);
+        if (s.size() > size)
+            r.ec = errc::value_too_large;
+        else
+            r.ptr = copy(s.begin(), s.end(), out);
+    }
+    if (r.ec != errc{})
+        throw runtime_error("Result buffer is too small");
+    return r.ptr - out;
+}
+
+// Binary form of values, a 4-byte little-endian length and the bytes. Text,
+// like string, string_view, char arrays or C strings, goes as its chars up to
+// the NUL.
+template <typename T>
+concept ibsTextBinary = is_convertible_v<const T &, string_view>;
+
+template <typename T>
+concept ibsRawBinary = is_trivially_copyable_v<T> && !is_pointer_v<T> && !ibsTextBinary<T>;
+
+inline void ibsPutLength(uint32_t n, char *out){
+    for (size_t i = 0; i < 4; i ++)
+        out[i] = char(n >> (8 * i));
+}
+
+inline uint32_t ibsGetLength(const char *p){
+    uint32_t n = 0;
+    for (size_t i = 0; i < 4; i ++)
+        n |= uint32_t(static_cast<unsigned char>(p[i])) << (8 * i);
+    return n;
+}
+
+// Writes v to out, and returns the bytes written
+template <typename T>
+size_t ToBinary(const T &v, char *out, size_t size){
+    if (size < 4)
+        throw runtime_error("Result buffer is too small");
+    size_t n;
+    if constexpr (ibsRawBinary<T>){
+        if (size - 4 < sizeof(T))
+            throw runtime_error("Result buffer is too small");
+        memcpy(out + 4, &v, n = sizeof(T));
+    }
+    else if constexpr (ibsTextBinary<T>){
+        string_view t(v);
+        if (size - 4 < t.size())
+            throw runtime_error("Result buffer is too small");
+        n = t.copy(out + 4, t.size());
+    }
+    else
+        n = ToChars(v, out + 4, size - 4);
+    ibsPutLength(n, out);
+    return n + 4;
+}
+
+// Reads a value from p and moves p after it
+template <typename T>
+T FromBinary(const char *&p, const char *e){
+    if (e - p < 4 || size_t(e - p - 4) < ibsGetLength(p))
+        throw runtime_error("Binary value is cut short");
+    size_t n = ibsGetLength(p);
+    const char *b = p + 4;
+    p = b + n;
+    if constexpr (is_same_v<T, bool>)
+        return n == 1 && *b;
+    else if constexpr (ibsRawBinary<T>){
+        if (n != sizeof(T))
+            throw runtime_error("Binary value of a wrong size");
+        T v;
+        memcpy(&v, b, sizeof(T));
+        return v;
+    }
+    else if constexpr (is_same_v<T, string>)
+        return string(b, n);
+    else
+        return FromChars<T>(string_view(b, n));
+}
+
+// For clients, packing arguments and unpacking results
+template <typename T>
+void ibsPutBinary(string &buf, const T &v){
+    size_t k = buf.size();
+    if constexpr (ibsRawBinary<T>)
+        buf.resize(k + 4 + sizeof(T));
+    else if constexpr (ibsTextBinary<T>)
+        buf.resize(k + 4 + string_view(v).size());
+    if constexpr (ibsRawBinary<T> || ibsTextBinary<T>)
+        ToBinary(v, buf.data() + k, buf.size() - k);
+    else
+        ibsPutBinary(buf, ToString(v));
+}
+
+template <typename... T>
+string ibsPackArgs(const T &... a){
+    string buf;
+    (ibsPutBinary(buf, a), ...);
+    return buf;
+}
+
+template <typename T>
+T ibsUnpackResult(const char *p, size_t n){
+    return FromBinary<T>(p, p + n);
+}
+
+template <Streamable_in T>
+T ArgFromString(const string &s){ return FromString<T>(s); }
+
+template <Streamable_in T>
+T ArgFromString(string_view s){ return FromChars<T>(s); }
+
+// Call metrics
+#ifdef STR_INVOKE_METRICS
+#define IBS_METRIC(...) __VA_ARGS__
+#else
+#define IBS_METRIC(...)
+#endif
+
+#ifdef STR_INVOKE_METRICS
+enum ibsPhase{ ibsParse, ibsRun, ibsFormat, ibsPhases };
+const char *const ibsPhaseNames[ibsPhases] = {"parse", "call", "format"};
+// Bucket i counts durations in [2^(i-1), 2^i) ns
+constexpr size_t ibsHistBuckets = 64;
+
+// Written by one thread only, so a load and a store is enough to add.
+inline void ibsBump(atomic<uint64_t> &c, uint64_t v = 1){
+    c.store(c.load(memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+// Calls answered from a cache count as calls and hits, with no time
+struct ibsCallCounters{
+    atomic<uint64_t> calls{0}, errors{0}, hits{0};
+    atomic<uint64_t> ns[ibsPhases]{};
+    atomic<uint64_t> hist[ibsPhases][ibsHistBuckets]{};
+};
+
+struct ibsCallMetrics{
+    uint64_t calls = 0, errors = 0, hits = 0;
+    uint64_t ns[ibsPhases] = {};
+    uint64_t hist[ibsPhases][ibsHistBuckets] = {};
+
+    void add(const ibsCallCounters &c){
+        calls += c.calls.load(memory_order_relaxed);
+        errors += c.errors.load(memory_order_relaxed);
+        hits += c.hits.load(memory_order_relaxed);
+        for (size_t p = 0; p < ibsPhases; p ++){
+            ns[p] += c.ns[p].load(memory_order_relaxed);
+            for (size_t b = 0; b < ibsHistBuckets; b ++)
+                hist[p][b] += c.hist[p][b].load(memory_order_relaxed);
+        }
+    }
+    double mean_ns(size_t phase) const {
+        uint64_t n = calls - errors - hits;
+        return n ? double(ns[phase]) / n : 0;
+    }
+    // Upper bound of the bucket where q of all durations fall below
+    uint64_t quantile_ns(size_t phase, double q) const {
+        uint64_t n = 0, total = 0;
+        for (auto h: hist[phase])
+            total += h;
+        for (size_t b = 0; b < ibsHistBuckets; b ++)
+            if ((n += hist[phase][b]) > 0 && n >= q * total)
+                return b ? (uint64_t(1) << b) - 1 : 0;
+        return 0;
+    }
+};
+
+inline size_t ibsNextMetricId(){
+    static atomic<size_t> id{0};
+    return id ++;
+}
+
+// Counters of one thread, for all functions it called. When the thread ends,
+// its counters are moved to the retired ones.
+struct ibsThreadMetrics{
+    ibsThreadMetrics(){
+        lock_guard<mutex> l(lock());
+        threads().push_back(this);
+    }
+    ~ibsThreadMetrics(){
+        lock_guard<mutex> l(lock());
+        threads().erase(find(threads().begin(), threads().end(), this));
+        auto &r = retired();
+        if (r.size() < slots.size())
+            r.resize(slots.size());
+        for (size_t i = 0; i < slots.size(); i ++)
+            if (slots[i])
+                r[i].add(*slots[i]);
+    }
+    // Only the owner thread grows slots, others read them under m
+    ibsCallCounters &of(size_t id){
+        if (id >= slots.size() || !slots[id]){
+            lock_guard<mutex> l(m);
+            if (id >= slots.size())
+                slots.resize(id + 1);
+            slots[id] = make_unique<ibsCallCounters>();
+        }
+        return *slots[id];
+    }
+    static ibsThreadMetrics &local(){
+        thread_local ibsThreadMetrics t;
+        return t;
+    }
+    static mutex &lock(){
+        static mutex m;
+        return m;
+    }
+    static vector<ibsThreadMetrics *> &threads(){
+        static vector<ibsThreadMetrics *> t;
+        return t;
+    }
+    static vector<ibsCallMetrics> &retired(){
+        static vector<ibsCallMetrics> r;
+        return r;
+    }
+    static ibsCallMetrics sum(size_t id){
+        lock_guard<mutex> l(lock());
+        ibsCallMetrics r;
+        if (id < retired().size())
+            r = retired()[id];
+        for (auto t: threads()){
+            lock_guard<mutex> tl(t->m);
+            if (id < t->slots.size() && t->slots[id])
+                r.add(*t->slots[id]);
+        }
+        return r;
+    }
+
+    mutex m;
+    vector<unique_ptr<ibsCallCounters>> slots;
+};
+
+// Lives through one call. parsed() is called when all arguments are ready, 
+// called() when the function returns, and the rest is formatting. The timer 
+// of the running call is kept in current, so nested calls do not mix up.
+class ibsCallTimer{
+public:
+    using clock = chrono::steady_clock;
+    ibsCallTimer(size_t id):id(id), prev(current()), 
+        uncaught(uncaught_exceptions()), t0(clock::now()){ current() = this; }
+    ~ibsCallTimer(){
+        current() = prev;
+        ibsCallCounters &c = ibsThreadMetrics::local().of(id);
+        ibsBump(c.calls);
+        if (uncaught_exceptions() > uncaught){
+            ibsBump(c.errors);
+            return;
+        }
+        auto t3 = clock::now();
+        if (t1 < t0) t1 = t0;
+        if (t2 < t1) t2 = t1;
+        const clock::time_point ts[] = {t0, t1, t2, t3};
+        for (size_t p = 0; p < ibsPhases; p ++){
+            uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(
+                ts[p + 1] - ts[p]).count();
+            ibsBump(c.ns[p], ns);
+            ibsBump(c.hist[p][min<size_t>(bit_width(ns), ibsHistBuckets - 1)]);
+        }
+    }
+    static void parsed(){ 
+        if (current()) 
+            current()->t1 = clock::now(); 
+    }
+    void called(){ t2 = clock::now(); }
+    static void hit(size_t id){
+        ibsCallCounters &c = ibsThreadMetrics::local().of(id);
+        ibsBump(c.calls);
+        ibsBump(c.hits);
+    }
+private:
+    static ibsCallTimer *&current(){
+        thread_local ibsCallTimer *t = nullptr;
+        return t;
+    }
+    size_t id;
+    ibsCallTimer *prev;
+    int uncaught;
+    clock::time_point t0, t1{}, t2{};
+};
+#endif
+
 // Core functions for Invoke-By-Strings to work
 template <size_t n, Streamable_in T, typename... Args>
-auto StringToObject(const string &s){
+auto StringToObject(const auto &s){
     if constexpr (n)
         return StringToObject<n - 1, Args...>(s);
     else
-        return FromString<T>(s);
+        return ArgFromString<T>(s);
 }
 
-template <FunctionRet R, typename... FArgs, typename... Args>
-auto InvokeByStrings( R(&f)(FArgs...), const vector<string> &p, Args... a){
+// p is a span of string or string_view
+template <FunctionRet R, typename... FArgs, typename P, typename... Args>
+auto InvokeByStrings( R(&f)(FArgs...), const P &p, Args... a){
     // Iterating args right-to-left
     const size_t args_i = sizeof...(FArgs) - sizeof...(Args) - 1;
     if (p.size() < sizeof...(FArgs))
         throw runtime_error("Not enough arguments");
     if constexpr (sizeof...(Args) < sizeof...(FArgs))
         return InvokeByStrings( f, p, StringToObject< args_i, FArgs... >(p[args_i]), a... );
-    else
+    else {
+        IBS_METRIC(ibsCallTimer::parsed();)
         return f(a...); //Here, we emit the real call
+    }
 }
 
 // ibs - Invoke-By-Strings
 // Dynamic facilities
+// Hash for looking up string keys by string_view without making a string
+struct ibsHash{
+    using is_transparent = void;
+    size_t operator()(string_view s) const { return hash<string_view>{}(s); }
+};
+
+struct ibsRegistry;
+struct ibsStep;
+
 struct ibsBase{
-    virtual const string invoke(const vector<string> &p) = 0;
+    virtual ~ibsBase() = default;
+    virtual const string invoke(span<const string> p) = 0;
+    // Writes the result to out, and returns its length
+    virtual size_t invoke(span<const string_view> p, char *out, size_t size) = 0;
+    // Number of arguments that the function takes
+    virtual size_t arity() const = 0;
+    // A step of an ibsPlan that calls this function
+    virtual unique_ptr<ibsStep> step() const = 0;
+    // Arguments and the result in binary, returns the length of the result
+    virtual size_t invoke_binary(span<const char> in, char *out, size_t size) = 0;
     template <typename R, typename... Args>
-    static bool addFunction(R(&f)(Args...), const string &name);
-    static unordered_map<string, ibsBase*> ibsFunctions; // Naked poiner type?? This is a toy. If it breaks, buy a new one.
+    static bool addFunction(R(&f)(Args...), const string &name, 
+        bool concurrent = false, size_t cache_size = 0);
+    static ibsRegistry ibsFunctions;
+    // Safe to be called by many threads at the same time
+    bool concurrent = false;
+    IBS_METRIC(size_t metric_id = ibsNextMetricId();)
+};
+
+// The registry owns all callers. Before freeze(), names are kept in a hash 
+// map. freeze() builds a perfect hash by "hash and displace": names are put 
+// into small buckets by one hash, then from the largest bucket, each bucket
+// searches a seed so that a second hash puts all its names into free slots.
+// A lookup is then one hash of the name and one compare. If no seed is found, 
+// a table sorted by names is used instead.
+struct ibsRegistry{
+    bool add(const string &name, unique_ptr<ibsBase> f){
+        if (is_frozen)
+            throw runtime_error("Functions can not be added after freeze");
+        return functions.try_emplace(name, std::move(f)).second;
+    }
+
+    ibsBase *find(string_view name) const {
+        if (!is_frozen){
+            auto it = functions.find(name);
+            return it == functions.end() ? nullptr : it->second.get();
+        }
+        if (table.empty())
+            return nullptr;
+        if (seeds.empty()){
+            auto it = lower_bound(table.begin(), table.end(), name, 
+                [](const slot_t &a, string_view b){ return a.name < b; });
+            return (it != table.end() && it->name == name) ? it->f : nullptr;
+        }
+        size_t h = ibsHash{}(name);
+        const slot_t &t = table[slot(h, seeds[mix(h) % seeds.size()])];
+        return t.name == name ? t.f : nullptr;
+    }
+
+    bool contains(string_view name) const { return find(name) != nullptr; }
+    size_t size() const { return functions.size(); }
+    template <typename F>
+    void for_each(F func) const {
+        for (auto &f: functions)
+            func(string_view(f.first), f.second.get());
+    }
+    bool frozen() const { return is_frozen; }
+    bool perfect() const { return !seeds.empty(); }
+
+    void freeze(){
+        if (is_frozen)
+            return;
+        is_frozen = true;
+        size_t n = functions.size();
+        table.assign(n + n / 4 + 1, slot_t{});
+        seeds.assign((n + 3) / 4 + 1, 0);
+        vector<vector<pair<size_t, const decltype(functions)::value_type *>>> 
+            buckets(seeds.size());
+        for (auto &f: functions){
+            size_t h = ibsHash{}(f.first);
+            buckets[mix(h) % seeds.size()].push_back({h, &f});
+        }
+        vector<size_t> order(buckets.size());
+        for (size_t i = 0; i < order.size(); i ++)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&](size_t a, size_t b){ 
+            return buckets[a].size() > buckets[b].size(); 
+        });
+        vector<size_t> slots;
+        for (size_t b: order){
+            uint32_t seed = 1;
+            for (; seed < max_seed; seed ++){
+                slots.clear();
+                for (auto &e: buckets[b]){
+                    size_t i = slot(e.first, seed);
+                    if (table[i].f || 
+                        find_if(slots.begin(), slots.end(), 
+                            [&](size_t j){ return i == j; }) != slots.end())
+                        break;
+                    slots.push_back(i);
+                }
+                if (slots.size() == buckets[b].size())
+                    break;
+            }
+            if (seed == max_seed)
+                return sorted_table();
+            seeds[b] = seed;
+            for (size_t i = 0; i < slots.size(); i ++)
+                table[slots[i]] = { buckets[b][i].second->first, 
+                    buckets[b][i].second->second.get() };
+        }
+    }
+
+private:
+    struct slot_t{
+        string_view name;
+        ibsBase *f = nullptr;
+    };
+    static constexpr uint32_t max_seed = 1 << 16;
+
+    static size_t mix(size_t h){
+        h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    size_t slot(size_t h, uint32_t seed) const {
+        return mix(h ^ (seed * 0x9e3779b97f4a7c15ULL)) % table.size();
+    }
+
+    void sorted_table(){
+        seeds.clear();
+        table.clear();
+        for (auto &f: functions)
+            table.push_back({f.first, f.second.get()});
+        sort(table.begin(), table.end(), [](const slot_t &a, const slot_t &b){ 
+            return a.name < b.name; 
+        });
+    }
+
+    unordered_map<string, unique_ptr<ibsBase>, ibsHash, equal_to<>> functions;
+    vector<slot_t> table;
+    vector<uint32_t> seeds;
+    bool is_frozen = false;
+};
+ibsRegistry ibsBase::ibsFunctions;
+
+// Steps of call plans
+// A typed value held by a plan, either a constant argument or a result.
+struct ibsSlot{
+    virtual ~ibsSlot() = default;
+    virtual const type_info &type() const = 0;
+    virtual string str() const = 0;
+    virtual void parse(string_view s) = 0;
+};
+
+template <typename T>
+struct ibsSlotOf: public ibsSlot{
+    const type_info &type() const { return typeid(T); }
+    string str() const {
+        if constexpr (Streamable_out<T>)
+            return ToString(v);
+        else
+            throw runtime_error("Value can not be written as a string");
+    }
+    void parse(string_view s){
+        if constexpr (Streamable_in<T>)
+            v = FromChars<T>(s);
+        else
+            throw runtime_error("Value can not be read from a string");
+    }
+    T v{};
+};
+
+// One call of a plan. Each argument reads a slot: its own constant, the 
+// result of an earlier step of the same type, or its own slot which is 
+// refreshed before each call from an input or a result of another type.
+struct ibsStep{
+    virtual ~ibsStep() = default;
+    virtual void bind_constant(size_t i, string_view s) = 0;
+    virtual void bind_result(size_t i, ibsSlot *src) = 0;
+    virtual void bind_input(size_t i, size_t k) = 0;
+    virtual void run(span<const string_view> inputs) = 0;
+    // nullptr for void functions
+    virtual ibsSlot *result() = 0;
+};
+
+template <typename R, typename... FArgs>
+struct ibsStepOf: public ibsStep{
+    using fType = R(&)(FArgs...);
+    ibsStepOf(fType f):fp(f){}
+
+    void bind_constant(size_t i, string_view s){
+        bind_own(i, [s](ibsSlot &own){ own.parse(s); });
+    }
+    void bind_result(size_t i, ibsSlot *src){
+        bool done = false;
+        visit_arg(i, [&](auto k){
+            using T = remove_cvref_t<tuple_element_t<k, tuple<FArgs...>>>;
+            if (src->type() == typeid(T)){
+                get<k>(args) = static_cast<ibsSlotOf<T> *>(src);
+                done = true;
+            }
+        });
+        if (!done)
+            bind_own(i, [](ibsSlot &){}, 
+                [src](ibsSlot &own, span<const string_view>){ 
+                    own.parse(src->str()); 
+                });
+    }
+    void bind_input(size_t i, size_t k){
+        bind_own(i, [](ibsSlot &){}, 
+            [k](ibsSlot &own, span<const string_view> in){
+                if (k >= in.size())
+                    throw runtime_error("Not enough inputs");
+                own.parse(in[k]);
+            });
+    }
+    void run(span<const string_view> inputs){
+        for (auto &r: refresh)
+            r.second(*r.first, inputs);
+        apply([&](auto *... a){
+            if constexpr (is_void_v<R>)
+                fp(a->v...);
+            else
+                out.v = fp(a->v...);
+        }, args);
+    }
+    ibsSlot *result(){
+        if constexpr (is_void_v<R>)
+            return nullptr;
+        else
+            return &out;
+    }
+
+private:
+    template <typename F>
+    static void visit_arg(size_t i, F func){
+        [&]<size_t... ks>(index_sequence<ks...>){
+            ((ks == i ? func(integral_constant<size_t, ks>{}) : void()), ...);
+        }(index_sequence_for<FArgs...>{});
+    }
+
+    // Gives argument i a slot of its own
+    template <typename Init, typename Refresh = nullptr_t>
+    void bind_own(size_t i, Init init, Refresh r = nullptr){
+        visit_arg(i, [&](auto k){
+            using T = remove_cvref_t<tuple_element_t<k, tuple<FArgs...>>>;
+            auto own = make_unique<ibsSlotOf<T>>();
+            init(*own);
+            get<k>(args) = own.get();
+            if constexpr (!is_null_pointer_v<Refresh>)
+                refresh.push_back({own.get(), r});
+            owned.push_back(std::move(own));
+        });
+    }
+
+    fType fp;
+    tuple<ibsSlotOf<remove_cvref_t<FArgs>> *...> args{};
+    conditional_t<is_void_v<R>, char, ibsSlotOf<remove_cvref_t<conditional_t<is_void_v<R>, int, R>>>> out{};
+    vector<unique_ptr<ibsSlot>> owned;
+    vector<pair<ibsSlot *, function<void (ibsSlot &, span<const string_view>)>>> refresh;
 };
-unordered_map<string, ibsBase*> ibsBase::ibsFunctions;
 
 template <typename R, typename... FArgs>
 struct ibsCaller: public ibsBase {
     using fType = R(&)(FArgs...);
     ibsCaller(fType f):fp(f){}
-    const string invoke(const vector<string> &p) {
-        if constexpr (!is_void<R>::value)
-            return ToString(InvokeByStrings(fp, p));
+    const string invoke(span<const string> p) {
+        IBS_METRIC(ibsCallTimer timer(metric_id);)
+        if constexpr (!is_void<R>::value){
+            auto r = InvokeByStrings(fp, p);
+            IBS_METRIC(timer.called();)
+            return ToString(r);
+        }
         else {
             InvokeByStrings(fp, p);
+            IBS_METRIC(timer.called();)
             return string();
         }
     }
+    size_t invoke(span<const string_view> p, char *out, size_t size) {
+        IBS_METRIC(ibsCallTimer timer(metric_id);)
+        if constexpr (!is_void<R>::value){
+            auto r = InvokeByStrings(fp, p);
+            IBS_METRIC(timer.called();)
+            return ToChars(r, out, size);
+        }
+        else {
+            InvokeByStrings(fp, p);
+            IBS_METRIC(timer.called();)
+            return 0;
+        }
+    }
+    size_t invoke_binary(span<const char> in, char *out, size_t size) {
+        IBS_METRIC(ibsCallTimer timer(metric_id);)
+        const char *p = in.data(), *e = p + in.size();
+        // Braces decode arguments from left to right
+        tuple<remove_cvref_t<FArgs>...> a{ FromBinary<remove_cvref_t<FArgs>>(p, e)... };
+        if (p != e)
+            throw runtime_error("Too many binary arguments");
+        IBS_METRIC(ibsCallTimer::parsed();)
+        if constexpr (!is_void<R>::value){
+            auto r = apply(fp, a);
+            IBS_METRIC(timer.called();)
+            return ToBinary(r, out, size);
+        }
+        else {
+            apply(fp, a);
+            IBS_METRIC(timer.called();)
+            return 0;
+        }
+    }
+    size_t arity() const { return sizeof...(FArgs); }
+    unique_ptr<ibsStep> step() const { 
+        return make_unique<ibsStepOf<R, FArgs...>>(fp); 
+    }
     fType fp;
 };
 
-template <typename R, typename... Args>
-bool ibsBase::addFunction(R(&f)(Args...), const string &name){
-    if (ibsBase::ibsFunctions.contains(name))
+struct ibsCacheStats{
+    size_t hits, misses, evictions, size, capacity;
+};
+
+// Memoization for pure functions. Keys are the used arguments, with spaces 
+// around them trimmed. The cache is split into shards by the hash of keys, 
+// each with its own lock and its own CLOCK: a hit marks the entry, and the 
+// hand clears marks until it finds an unmarked entry to evict.
+struct ibsCachedCaller: public ibsBase {
+    ibsCachedCaller(unique_ptr<ibsBase> f, size_t capacity):fn(std::move(f)){
+        concurrent = true;
+        IBS_METRIC(metric_id = fn->metric_id;)
+        // Fewer shards for a small cache, and capacities that add up to it
+        used = clamp<size_t>(capacity, 1, shard_count);
+        for (size_t i = 0; i < used; i ++)
+            shards[i].capacity = max<size_t>(capacity, 1) / used 
+                + (i < max<size_t>(capacity, 1) % used);
+    }
+    const string invoke(span<const string> p) {
+        if (p.size() < fn->arity())
+            return fn->invoke(p);
+        string key;
+        make_key(p, key);
+        string r;
+        if (lookup(key, r)){
+            IBS_METRIC(ibsCallTimer::hit(metric_id);)
+            return r;
+        }
+        r = fn->invoke(p);
+        insert(key, r);
+        return r;
+    }
+    size_t invoke(span<const string_view> p, char *out, size_t size) {
+        if (p.size() < fn->arity())
+            return fn->invoke(p, out, size);
+        // Not thread_local: a cached function may call another one
+        string key, r;
+        make_key(p, key);
+        if (lookup(key, r)){
+            IBS_METRIC(ibsCallTimer::hit(metric_id);)
+            if (r.size() > size)
+                throw runtime_error("Result buffer is too small");
+            return r.copy(out, r.size());
+        }
+        size_t n = fn->invoke(p, out, size);
+        insert(key, string_view(out, n));
+        return n;
+    }
+    size_t arity() const { return fn->arity(); }
+    // Plans and binary calls go to the function directly, the cache keeps 
+    // only results as strings
+    unique_ptr<ibsStep> step() const { return fn->step(); }
+    size_t invoke_binary(span<const char> in, char *out, size_t size) {
+        return fn->invoke_binary(in, out, size);
+    }
+
+    ibsCacheStats stats(){
+        ibsCacheStats r{ hits, misses, evictions, 0, 0 };
+        for (auto &s: shards){
+            lock_guard<mutex> l(s.m);
+            r.size += s.entries.size();
+            r.capacity += s.capacity;
+        }
+        return r;
+    }
+
+private:
+    struct entry_t{
+        string key, value;
+        bool referenced;
+    };
+    struct shard_t{
+        mutex m;
+        unordered_map<string, size_t, ibsHash, equal_to<>> index;
+        vector<entry_t> entries;
+        size_t capacity = 0, hand = 0;
+    };
+    static constexpr size_t shard_count = 16;
+
+    // Each argument as its length and its trimmed bytes
+    template <typename P>
+    void make_key(const P &p, string &key) const {
+        key.clear();
+        for (size_t i = 0; i < fn->arity(); i ++){
+            string_view a = p[i];
+            while (!a.empty() && isspace(static_cast<unsigned char>(a.front())))
+                a.remove_prefix(1);
+            while (!a.empty() && isspace(static_cast<unsigned char>(a.back())))
+                a.remove_suffix(1);
+            uint32_t l = a.size();
+            key.append(reinterpret_cast<const char *>(&l), sizeof(l));
+            key.append(a);
+        }
+    }
+
+    shard_t &shard_of(string_view key){ 
+        return shards[ibsHash{}(key) % used]; 
+    }
+
+    bool lookup(string_view key, string &value){
+        shard_t &s = shard_of(key);
+        {
+            lock_guard<mutex> l(s.m);
+            auto it = s.index.find(key);
+            if (it != s.index.end()){
+                entry_t &e = s.entries[it->second];
+                e.referenced = true;
+                value = e.value;
+                hits ++;
+                return true;
+            }
+        }
+        misses ++;
         return false;
-    else
-        ibsBase::ibsFunctions[name] = new ibsCaller(f); // Memory leaks!! Wooops....
-    return true;
+    }
+
+    void insert(string_view key, string_view value){
+        shard_t &s = shard_of(key);
+        lock_guard<mutex> l(s.m);
+        // Another thread may have put it there
+        if (s.index.contains(key))
+            return;
+        if (s.entries.size() < s.capacity){
+            s.index.emplace(key, s.entries.size());
+            s.entries.push_back({string(key), string(value), false});
+            return;
+        }
+        while (s.entries[s.hand].referenced){
+            s.entries[s.hand].referenced = false;
+            s.hand = (s.hand + 1) % s.entries.size();
+        }
+        entry_t &e = s.entries[s.hand];
+        s.index.erase(e.key);
+        e.key = key;
+        e.value = value;
+        s.index.emplace(key, s.hand);
+        s.hand = (s.hand + 1) % s.entries.size();
+        evictions ++;
+    }
+
+    unique_ptr<ibsBase> fn;
+    array<shard_t, shard_count> shards;
+    size_t used;      // shards in use
+    atomic<size_t> hits{0}, misses{0}, evictions{0};
+};
+
+template <typename R, typename... Args>
+bool ibsBase::addFunction(R(&f)(Args...), const string &name, bool concurrent, 
+    size_t cache_size){
+    unique_ptr<ibsBase> c = make_unique<ibsCaller<R, Args...>>(f);
+    c->concurrent = concurrent;
+    if (cache_size)
+        c = make_unique<ibsCachedCaller>(std::move(c), cache_size);
+    return ibsBase::ibsFunctions.add(name, std::move(c));
+}
+
+// A resolved function. Calls through it do not look up names any more.
+struct ibsHandle{
+    const string operator()(span<const string> p) const { return f->invoke(p); }
+    const string operator()(const vector<string> &p) const { 
+        return f->invoke(span<const string>(p)); 
+    }
+    size_t operator()(span<const string_view> p, char *out, size_t size) const {
+        return f->invoke(p, out, size);
+    }
+    size_t binary(span<const char> in, char *out, size_t size) const {
+        return f->invoke_binary(in, out, size);
+    }
+    ibsBase *f;
+};
+
+ibsHandle ibsResolve(string_view name){
+    ibsBase *f = ibsBase::ibsFunctions.find(name);
+    if (!f)
+        throw runtime_error("Required function was not registered");
+    return ibsHandle{f};
+}
+
+#ifdef STR_INVOKE_METRICS
+ibsCallMetrics ibsMetrics(string_view name){
+    return ibsThreadMetrics::sum(ibsResolve(name).f->metric_id);
+}
+
+// One line for each function: calls, errors, cache hits, and mean/p50/p99 
+// of each phase. The line is made aside, so the format of o is kept.
+void ibsDumpMetrics(ostream &o, string_view name){
+    ibsCallMetrics m = ibsMetrics(name);
+    ostringstream l;
+    l << name << ": calls " << m.calls << " errors " << m.errors;
+    if (m.hits)
+        l << " hits " << m.hits;
+    for (size_t p = 0; p < ibsPhases; p ++)
+        l << " | " << ibsPhaseNames[p] << " mean " << fixed << setprecision(1)
+          << m.mean_ns(p) << defaultfloat << "ns p50 <" << m.quantile_ns(p, 0.5) 
+          << "ns p99 <" << m.quantile_ns(p, 0.99) << "ns";
+    l << '\n';
+    o << l.view();
+}
+
+void ibsDumpMetrics(ostream &o){
+    vector<string_view> names;
+    ibsBase::ibsFunctions.for_each([&](string_view n, ibsBase *){ 
+        names.push_back(n); 
+    });
+    sort(names.begin(), names.end());
+    for (auto n: names)
+        ibsDumpMetrics(o, n);
+}
+#endif
+
+ibsCacheStats ibsCacheStatus(string_view name){
+    auto c = dynamic_cast<ibsCachedCaller *>(ibsResolve(name).f);
+    if (!c)
+        throw runtime_error("Function was not exported as cached");
+    return c->stats();
 }
 
 // Exposing interface function to clients
+const string ibsCall(const string &name, span<const string> p){
+    return ibsResolve(name)(p);
+}
+
 const string ibsCall(const string &name, const vector<string> &p){
-    if (ibsBase::ibsFunctions.contains(name))
-        return ibsBase::ibsFunctions[name]->invoke(p);
-    else
-        throw runtime_error("Required function was not registered");
+    return ibsCall(name, span<const string>(p));
 }
 
 const string ibsCall(const vector<string> &p){
-    const vector<string> a (p.begin() + 1,p.end());
-    return ibsCall(p[0], a);
+    if (p.empty())
+        throw runtime_error("Function name is missing");
+    return ibsCall(p[0], span<const string>(p).subspan(1));
+}
+
+size_t ibsCall(string_view name, span<const string_view> p, char *out, size_t size){
+    return ibsResolve(name)(p, out, size);
+}
+
+size_t ibsCall(span<const string_view> p, char *out, size_t size){
+    if (p.empty())
+        throw runtime_error("Function name is missing");
+    return ibsCall(p[0], p.subspan(1), out, size);
+}
+
+size_t ibsCallBinary(string_view name, span<const char> in, char *out, size_t size){
+    return ibsResolve(name).binary(in, out, size);
+}
+
+// Batch calls
+// A work-stealing pool. Each worker has its own queue of tasks. It takes tasks
+// from the back of its own queue, and steals from the front of other queues 
+// when its own queue is empty.
+class ibsThreadPool{
+public:
+    explicit ibsThreadPool(size_t n = thread::hardware_concurrency()){
+        n = max<size_t>(n, 1);
+        for (size_t i = 0; i < n; i ++)
+            queues.push_back(make_unique<queue_t>());
+        for (size_t i = 0; i < n; i ++)
+            threads.emplace_back([this, i]{ work(i); });
+    }
+    ~ibsThreadPool(){
+        {
+            lock_guard<mutex> l(m);
+            stop = true;
+        }
+        cv.notify_all();
+        for (auto &t: threads)
+            t.join();
+    }
+    size_t size() const { return threads.size(); }
+
+    // Runs func(i) for all i in [0, n), and returns when all are done
+    void run(size_t n, const function<void (size_t)> &func){
+        if (!n)
+            return;
+        lock_guard<mutex> r(running);
+        {
+            lock_guard<mutex> l(m);
+            pending = n;
+        }
+        for (size_t i = 0; i < n; i ++){
+            lock_guard<mutex> l(queues[i % queues.size()]->m);
+            queues[i % queues.size()]->q.push_back({&func, i});
+        }
+        unique_lock<mutex> l(m);
+        generation ++;
+        cv.notify_all();
+        done.wait(l, [&]{ return pending == 0; });
+    }
+
+private:
+    // A task keeps its own func, a late worker may take tasks of a next run.
+    struct task_t{
+        const function<void (size_t)> *func;
+        size_t i;
+    };
+
+    struct queue_t{
+        mutex m;
+        deque<task_t> q;
+    };
+
+    bool next(size_t id, task_t &task){
+        for (size_t k = 0; k < queues.size(); k ++){
+            queue_t &q = *queues[(id + k) % queues.size()];
+            lock_guard<mutex> l(q.m);
+            if (q.q.empty())
+                continue;
+            if (k == 0){
+                task = q.q.back();
+                q.q.pop_back();
+            }
+            else {
+                task = q.q.front();
+                q.q.pop_front();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t id){
+        size_t seen = 0;
+        for (;;){
+            {
+                unique_lock<mutex> l(m);
+                cv.wait(l, [&]{ return stop || generation != seen; });
+                if (stop)
+                    return;
+                seen = generation;
+            }
+            task_t task;
+            while (next(id, task)){
+                (*task.func)(task.i);
+                lock_guard<mutex> l(m);
+                if (-- pending == 0)
+                    done.notify_all();
+            }
+        }
+    }
+
+    vector<thread> threads;
+    vector<unique_ptr<queue_t>> queues;
+    mutex m, running;
+    condition_variable cv, done;
+    size_t pending = 0, generation = 0;
+    bool stop = false;
+};
+
+// Arguments of many calls, either a row-major block of rows * cols cells, or 
+// cols columns with the same number of rows.
+struct ibsBatchArgs{
+    ibsBatchArgs(span<const string_view> cells, size_t cols)
+        :cells(cells), cols(cols), n(cols ? cells.size() / cols : 0){}
+    ibsBatchArgs(span<const span<const string_view>> columns)
+        :columns(columns), cols(columns.size()), 
+        n(columns.empty() ? 0 : columns[0].size()){
+        for (auto &c: columns)
+            if (c.size() != n)
+                throw runtime_error("Columns of different sizes");
+    }
+    size_t rows() const { return n; }
+
+    // Row r, gathered into tmp if the block is columnar
+    span<const string_view> row(size_t r, vector<string_view> &tmp) const {
+        if (columns.empty())
+            return cells.subspan(r * cols, cols);
+        tmp.resize(cols);
+        for (size_t c = 0; c < cols; c ++)
+            tmp[c] = columns[c][r];
+        return tmp;
+    }
+
+    span<const string_view> cells;
+    span<const span<const string_view>> columns;
+    size_t cols, n;
+};
+
+// Calls name for all rows. The result of row r is written to out + r * slot, 
+// and its length to lens[r]. If any call throws, the first exception is 
+// thrown again after all rows are done.
+void ibsBatchCall(string_view name, const ibsBatchArgs &args, char *out, 
+    size_t slot, size_t *lens, ibsThreadPool *pool = nullptr){
+    ibsHandle h = ibsResolve(name);
+    size_t rows = args.rows();
+    const size_t chunk = 256;
+    exception_ptr err;
+    mutex err_m;
+    auto run_chunk = [&](size_t c){
+        vector<string_view> tmp;
+        for (size_t r = c * chunk; r < min(rows, (c + 1) * chunk); r ++){
+            try {
+                lens[r] = h(args.row(r, tmp), out + r * slot, slot);
+            }
+            catch (...){
+                lens[r] = 0;
+                lock_guard<mutex> l(err_m);
+                if (!err)
+                    err = current_exception();
+            }
+        }
+    };
+    size_t chunks = (rows + chunk - 1) / chunk;
+    if (pool && h.f->concurrent && chunks > 1)
+        pool->run(chunks, run_chunk);
+    else
+        for (size_t c = 0; c < chunks; c ++)
+            run_chunk(c);
+    if (err)
+        rethrow_exception(err);
+}
+
+// Command server
+// Appends arguments of the line from p to tokens, and returns the start of 
+// the next line. Arguments are split by spaces, "quoted" ones keep spaces.
+inline const char *ibsSplitLine(const char *p, const char *e, 
+    vector<string_view> &tokens){
+    while (p < e && *p != '\n'){
+        if (*p == ' ' || *p == '\t' || *p == '\r'){
+            p ++;
+            continue;
+        }
+        const char *s = p;
+        if (*p == '"'){
+            s = ++ p;
+            while (p < e && *p != '"' && *p != '\n')
+                p ++;
+            tokens.emplace_back(s, p - s);
+            if (p < e && *p == '"')
+                p ++;
+        }
+        else {
+            while (p < e && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+                p ++;
+            tokens.emplace_back(s, p - s);
+        }
+    }
+    return p < e ? p + 1 : p;
+}
+
+// A bounded blocking queue. push waits when the queue is full, so a fast stage
+// can not run too far ahead of a slow one.
+template <typename T>
+class ibsQueue{
+public:
+    explicit ibsQueue(size_t capacity):capacity(max<size_t>(capacity, 1)){}
+    bool push(T v){
+        unique_lock<mutex> l(m);
+        not_full.wait(l, [&]{ return closed || q.size() < capacity; });
+        if (closed)
+            return false;
+        q.push_back(std::move(v));
+        not_empty.notify_one();
+        return true;
+    }
+    // Returns false when the queue is full or closed, v is not moved then
+    bool try_push(T &v){
+        lock_guard<mutex> l(m);
+        if (closed || q.size() >= capacity)
+            return false;
+        q.push_back(std::move(v));
+        not_empty.notify_one();
+        return true;
+    }
+    // Returns false when the queue is closed and empty
+    bool pop(T &v){
+        unique_lock<mutex> l(m);
+        not_empty.wait(l, [&]{ return closed || !q.empty(); });
+        if (q.empty())
+            return false;
+        v = std::move(q.front());
+        q.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+    void close(){
+        lock_guard<mutex> l(m);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+private:
+    size_t capacity;
+    deque<T> q;
+    mutex m;
+    condition_variable not_empty, not_full;
+    bool closed = false;
+};
+
+struct ibsServerOptions{
+    size_t read_size = 1 << 20;   // bytes for each read
+    size_t queue_depth = 8;       // batches waiting between two stages
+    size_t workers = 1;           // >1 for out-of-order calls
+    size_t result_size = 4096;    // longest result of one call
+};
+
+class ibsServer{
+public:
+    // read returns 0 at the end of input
+    using reader_t = function<size_t (char *, size_t)>;
+    using writer_t = function<void (const char *, size_t)>;
+
+    explicit ibsServer(ibsServerOptions o = {}):opt(o){}
+
+    // Returns the number of commands. An exception of read, write or a worker
+    // stops the server, and is thrown here after all threads are joined.
+    size_t serve(const reader_t &read, const writer_t &write){
+        ibsQueue<unique_ptr<batch_t>> calls(opt.queue_depth), 
+            results(opt.queue_depth);
+        exception_ptr error;
+        mutex error_lock;
+        auto fail = [&]{
+            {
+                lock_guard<mutex> lk(error_lock);
+                if (!error)
+                    error = current_exception();
+            }
+            calls.close();
+            results.close();
+        };
+        vector<thread> workers;
+        size_t n = 0;
+        for (size_t i = 0; i < max<size_t>(opt.workers, 1); i ++)
+            workers.emplace_back([&]{ 
+                try {
+                    unique_ptr<batch_t> b;
+                    while (calls.pop(b)){
+                        dispatch(*b);
+                        results.push(std::move(b));
+                    }
+                }
+                catch (...){
+                    fail();
+                }
+            });
+        thread writer([&]{
+            try {
+                map<size_t, unique_ptr<batch_t>> early;
+                unique_ptr<batch_t> b;
+                size_t next = 0;
+                while (results.pop(b)){
+                    early[b->seq] = std::move(b);
+                    for (auto it = early.begin(); 
+                        it != early.end() && it->first == next; 
+                        it = early.erase(it), next ++)
+                        write(it->second->out.data(), it->second->out_size);
+                }
+            }
+            catch (...){
+                fail();
+            }
+        });
+        try {
+            string carry;
+            vector<char> block(opt.read_size);
+            for (size_t seq = 0, k; ; ){
+                k = read(block.data(), block.size());
+                const char *e = block.data() + k;
+                const char *nl = e;
+                while (nl > block.data() && nl[-1] != '\n')
+                    nl --;
+                // No line ends in this block, it is kept for the next one
+                if (k > 0 && nl == block.data()){
+                    carry.append(block.data(), k);
+                    continue;
+                }
+                auto b = make_unique<batch_t>();
+                b->seq = seq;
+                b->text = std::move(carry);
+                b->text.append(block.data(), nl - block.data());
+                carry.assign(nl, e);
+                tokenize(*b);
+                if (!b->lines.empty()){
+                    n += b->lines.size();
+                    if (!calls.push(std::move(b)))
+                        break;
+                    seq ++;
+                }
+                if (k == 0)
+                    break;
+            }
+        }
+        catch (...){
+            fail();
+        }
+        calls.close();
+        for (auto &w: workers)
+            w.join();
+        results.close();
+        writer.join();
+        if (error)
+            rethrow_exception(error);
+        return n;
+    }
+
+private:
+    struct batch_t{
+        size_t seq;
+        string text;
+        vector<string_view> tokens;
+        vector<size_t> lines;      // end of each line in tokens
+        string out;
+        size_t out_size = 0;
+    };
+
+    // Splits text into lines and arguments. Empty lines are dropped.
+    static void tokenize(batch_t &b){
+        const char *p = b.text.data(), *e = p + b.text.size();
+        while (p < e){
+            size_t first = b.tokens.size();
+            p = ibsSplitLine(p, e, b.tokens);
+            if (b.tokens.size() > first)
+                b.lines.push_back(b.tokens.size());
+        }
+    }
+
+    void dispatch(batch_t &b){
+        string_view last_name;
+        ibsBase *f = nullptr;
+        for (size_t l = 0, first = 0; l < b.lines.size(); first = b.lines[l ++]){
+            span<const string_view> line(b.tokens.data() + first, 
+                b.lines[l] - first);
+            if (b.out.size() < b.out_size + opt.result_size + 1)
+                b.out.resize(2 * b.out.size() + opt.result_size + 1);
+            try {
+                if (line[0] != last_name){
+                    last_name = line[0];
+                    f = ibsBase::ibsFunctions.find(last_name);
+                }
+                if (!f)
+                    throw runtime_error("Required function was not registered");
+                char *o = b.out.data() + b.out_size;
+                if (f->concurrent || opt.workers <= 1)
+                    b.out_size += f->invoke(line.subspan(1), o, opt.result_size);
+                else {
+                    lock_guard<mutex> lk(serial);
+                    b.out_size += f->invoke(line.subspan(1), o, opt.result_size);
+                }
+            }
+            catch (exception &e){
+                string m = string("ERROR: ") + e.what();
+                m.resize(min(m.size(), opt.result_size));
+                b.out_size += m.copy(b.out.data() + b.out_size, m.size());
+            }
+            b.out[b.out_size ++] = '\n';
+        }
+    }
+
+    ibsServerOptions opt;
+    mutex serial;     // for functions not exported as concurrent
+};
+
+// Reads what is ready in the stream, or at least one line
+inline ibsServer::reader_t ibsStreamReader(istream &is){
+    return [&is](char *b, size_t n) -> size_t {
+        auto *sb = is.rdbuf();
+        using tr = char_traits<char>;
+        if (sb->sgetc() == tr::eof())
+            return 0;
+        streamsize k = sb->in_avail();
+        if (k > 0)
+            return sb->sgetn(b, min<streamsize>(k, n));
+        size_t i = 0;
+        for (int c; i < n && (c = sb->sbumpc()) != tr::eof(); )
+            if ((b[i ++] = tr::to_char_type(c)) == '\n')
+                break;
+        return i;
+    };
+}
+
+inline ibsServer::writer_t ibsStreamWriter(ostream &os){
+    return [&os](const char *b, size_t n){ os.write(b, n).flush(); };
+}
+
+#ifdef __STR_INVOKE_POSIX__
+inline ibsServer::reader_t ibsFdReader(int fd){
+    return [fd](char *b, size_t n) -> size_t {
+        for (;;){
+            ssize_t k = ::read(fd, b, n);
+            if (k >= 0)
+                return k;
+            if (errno != EINTR)
+                throw runtime_error("Unable to read commands");
+        }
+    };
+}
+
+inline ibsServer::writer_t ibsFdWriter(int fd){
+    return [fd](const char *b, size_t n){
+        while (n){
+            ssize_t k = ::write(fd, b, n);
+            if (k < 0 && errno == EINTR)
+                continue;
+            if (k < 0)
+                throw runtime_error("Unable to write results");
+            b += k;
+            n -= k;
+        }
+    };
+}
+
+// Files, pipes or sockets
+inline size_t ibsServeFd(int in, int out, ibsServerOptions o = {}){
+    return ibsServer(o).serve(ibsFdReader(in), ibsFdWriter(out));
+}
+
+inline sockaddr_un ibsUnixAddress(const string &path){
+    sockaddr_un a{};
+    a.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(a.sun_path))
+        throw runtime_error("Socket path is too long");
+    path.copy(a.sun_path, path.size());
+    return a;
+}
+
+// Serves clients one after another on a Unix domain socket, until 
+// max_clients clients are served.
+inline size_t ibsServeUnix(const string &path, size_t max_clients = SIZE_MAX, 
+    ibsServerOptions o = {}){
+    sockaddr_un a = ibsUnixAddress(path);
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    ::unlink(path.c_str());
+    if (s < 0 || bind(s, (sockaddr *)&a, sizeof(a)) < 0 || listen(s, 16) < 0){
+        if (s >= 0)
+            ::close(s);
+        throw runtime_error("Unable to listen on the socket");
+    }
+    size_t n = 0;
+    for (size_t c = 0; c < max_clients; c ++){
+        int fd = accept(s, nullptr, nullptr);
+        if (fd < 0)
+            break;
+        n += ibsServeFd(fd, fd, o);
+        ::close(fd);
+    }
+    ::close(s);
+    ::unlink(path.c_str());
+    return n;
+}
+
+// A client. Write commands to the fd, shutdown(fd, SHUT_WR) when all are 
+// written, and read results from the fd.
+inline int ibsConnectUnix(const string &path){
+    sockaddr_un a = ibsUnixAddress(path);
+    int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s < 0 || connect(s, (sockaddr *)&a, sizeof(a)) < 0){
+        if (s >= 0)
+            ::close(s);
+        throw runtime_error("Unable to connect to the socket");
+    }
+    return s;
+}
+#endif
+
+// Call plans
+// A script is compiled into steps, one for each line like
+//     [var =] function arg1 arg2 ...
+// where an argument is a constant, $var for the result of an earlier line, or
+// $0, $1, ... for inputs of run(). Empty lines and lines with # are skipped.
+class ibsPlan{
+public:
+    explicit ibsPlan(string_view script){
+        const char *p = script.data(), *e = p + script.size();
+        vector<string_view> t;
+        while (p < e){
+            t.clear();
+            p = ibsSplitLine(p, e, t);
+            if (t.empty() || t[0].starts_with('#'))
+                continue;
+            string_view var;
+            if (t.size() > 2 && t[1] == "="){
+                var = t[0];
+                t.erase(t.begin(), t.begin() + 2);
+            }
+            compile(t);
+            if (!var.empty())
+                vars[string(var)] = steps.size() - 1;
+        }
+    }
+
+    void run(span<const string_view> inputs = {}){
+        for (auto &s: steps)
+            s->run(inputs);
+    }
+    void run(initializer_list<string_view> inputs){
+        run(span<const string_view>(inputs.begin(), inputs.size()));
+    }
+
+    size_t size() const { return steps.size(); }
+
+    // Result of the last step, or of $var
+    string result() const { return slot_of({})->str(); }
+    string result(string_view var) const { return slot_of(var)->str(); }
+
+    template <typename T>
+    const T &value(string_view var = {}) const {
+        ibsSlot *s = slot_of(var);
+        if (s->type() != typeid(T))
+            throw runtime_error("Result is of another type");
+        return static_cast<ibsSlotOf<T> *>(s)->v;
+    }
+
+private:
+    void compile(span<const string_view> t){
+        ibsBase *f = ibsResolve(t[0]).f;
+        auto s = f->step();
+        if (t.size() - 1 < f->arity())
+            throw runtime_error("Not enough arguments");
+        for (size_t i = 0; i < f->arity(); i ++){
+            string_view a = t[i + 1];
+            if (a.size() < 2 || a[0] != '$')
+                s->bind_constant(i, a);
+            else if (isdigit(static_cast<unsigned char>(a[1])))
+                s->bind_input(i, FromChars<size_t>(a.substr(1)));
+            else
+                s->bind_result(i, slot_of(a.substr(1)));
+        }
+        steps.push_back(std::move(s));
+    }
+
+    ibsSlot *slot_of(string_view var) const {
+        size_t i = steps.size() - 1;
+        if (!var.empty()){
+            auto it = vars.find(var);
+            if (it == vars.end())
+                throw runtime_error("Unknown variable in plan");
+            i = it->second;
+        }
+        else if (steps.empty())
+            throw runtime_error("Plan is empty");
+        ibsSlot *s = steps[i]->result();
+        if (!s)
+            throw runtime_error("Step has no result");
+        return s;
+    }
+
+    vector<unique_ptr<ibsStep>> steps;
+    unordered_map<string, size_t, ibsHash, equal_to<>> vars;
+};
+
+// Asynchronous calls
+// What to do with a new task when the queue of an executor is full
+enum class ibsWhenFull{
+    wait,           // wait for room in the queue
+    caller_runs,    // run it in the thread that posts it
+    reject          // throw
+};
+
+struct ibsExecutorOptions{
+    size_t workers = thread::hardware_concurrency();
+    size_t queue_depth = 1024;    // tasks waiting for a worker
+    ibsWhenFull when_full = ibsWhenFull::wait;
+};
+
+// Workers take tasks from one bounded queue. Functions not exported as 
+// concurrent are called one at a time, by holding serial. A worker never waits
+// for room in its own queue, as all workers could wait there for ever. It 
+// runs the task by itself instead.
+class ibsExecutor{
+public:
+    explicit ibsExecutor(ibsExecutorOptions o = {})
+        :opt(o), tasks(o.queue_depth){
+        for (size_t i = 0; i < max<size_t>(opt.workers, 1); i ++)
+            threads.emplace_back([this]{
+                current() = this;
+                function<void ()> t;
+                while (tasks.pop(t))
+                    t();
+            });
+    }
+    // Tasks in the queue are still done
+    ~ibsExecutor(){
+        tasks.close();
+        for (auto &t: threads)
+            t.join();
+    }
+    size_t size() const { return threads.size(); }
+    const ibsExecutorOptions &options() const { return opt; }
+
+    // Returns false if the task is not queued and the caller should run it
+    bool post(function<void ()> &task){
+        if (tasks.try_push(task))
+            return true;
+        if (current() == this)
+            return false;
+        switch (opt.when_full){
+        case ibsWhenFull::wait:
+            if (!tasks.push(std::move(task)))
+                throw runtime_error("Executor is closed");
+            return true;
+        case ibsWhenFull::caller_runs:
+            return false;
+        default:
+            throw runtime_error("Executor queue is full");
+        }
+    }
+    void submit(function<void ()> task){
+        if (!post(task))
+            task();
+    }
+
+    // Calls f with p, in the way the function allows
+    string call(ibsBase *f, span<const string> p){
+        if (f->concurrent)
+            return f->invoke(p);
+        lock_guard<mutex> l(serial);
+        return f->invoke(p);
+    }
+
+private:
+    // The executor of this thread, if it is a worker
+    static ibsExecutor *&current(){
+        thread_local ibsExecutor *e = nullptr;
+        return e;
+    }
+
+    ibsExecutorOptions opt;
+    ibsQueue<function<void ()>> tasks;
+    vector<thread> threads;
+    mutex serial;
+};
+
+// Used when no executor is given
+inline ibsExecutor &ibsDefaultExecutor(){
+    static ibsExecutor e;
+    return e;
+}
+
+// The function is found at once, an unknown name throws here. Arguments are
+// parsed in the executor, so the caller can go on with the next call.
+inline future<string> ibsCallAsync(const string &name, vector<string> p, 
+    ibsExecutor &ex = ibsDefaultExecutor()){
+    ibsBase *f = ibsResolve(name).f;
+    auto pr = make_shared<promise<string>>();
+    future<string> r = pr->get_future();
+    ex.submit([f, p = std::move(p), pr, &ex]{
+        try {
+            pr->set_value(ex.call(f, p));
+        }
+        catch (...){
+            pr->set_exception(current_exception());
+        }
+    });
+    return r;
+}
+
+inline future<string> ibsCallAsync(vector<string> p, 
+    ibsExecutor &ex = ibsDefaultExecutor()){
+    if (p.empty())
+        throw runtime_error("Function name is missing");
+    string name = std::move(p[0]);
+    p.erase(p.begin());
+    return ibsCallAsync(name, std::move(p), ex);
+}
+
+// co_await it in a coroutine. The coroutine is resumed by the worker that 
+// made the call, or goes on at once if the call ran in the caller.
+class ibsCallAwaiter{
+public:
+    ibsCallAwaiter(const string &name, vector<string> p, ibsExecutor &ex)
+        :f(ibsResolve(name).f), p(std::move(p)), ex(ex){}
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(coroutine_handle<> h){
+        // Nothing of this may be touched once the task is queued, the 
+        // coroutine may be resumed and this destroyed before post returns.
+        function<void ()> task = [this, h]{
+            run();
+            h.resume();
+        };
+        if (ex.post(task))
+            return true;
+        run();
+        return false;
+    }
+    string await_resume(){
+        if (err)
+            rethrow_exception(err);
+        return std::move(r);
+    }
+
+private:
+    void run(){
+        try {
+            r = ex.call(f, p);
+        }
+        catch (...){
+            err = current_exception();
+        }
+    }
+
+    ibsBase *f;
+    vector<string> p;
+    ibsExecutor &ex;
+    string r;
+    exception_ptr err;
+};
+
+inline ibsCallAwaiter ibsAwaitCall(const string &name, vector<string> p, 
+    ibsExecutor &ex = ibsDefaultExecutor()){
+    return ibsCallAwaiter(name, std::move(p), ex);
+}
+
+inline ibsCallAwaiter ibsAwaitCall(vector<string> p, 
+    ibsExecutor &ex = ibsDefaultExecutor()){
+    if (p.empty())
+        throw runtime_error("Function name is missing");
+    string name = std::move(p[0]);
+    p.erase(p.begin());
+    return ibsCallAwaiter(name, std::move(p), ex);
 }
 
 #define export_function(f) if (!ibsBase::addFunction(f, #f)) throw runtime_error("Duplicate function names");
+#define export_concurrent_function(f) if (!ibsBase::addFunction(f, #f, true)) throw runtime_error("Duplicate function names");
+#define export_cached_function(f, n) if (!ibsBase::addFunction(f, #f, true, n)) throw runtime_error("Duplicate function names");
 
 // End of the Invoke-By-Strings
 
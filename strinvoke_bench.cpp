@@ -0,0 +1,232 @@
+/*
+ * strinvoke_bench.cpp - Timing ibsBatchCall, ibsPlan, binary calls and ibsServer
+ *     Author: Dr. Pu-Feng Du (2025)
+ *     A table of rows * 3 random arguments is called row by row with ibsCall,
+ *     and then in one ibsBatchCall, first on one thread and then on a pool.
+ *     All results must be the same. A script of two chained calls is run as
+ *     direct calls, as ibsCall lines and as a compiled ibsPlan. Typed values
+ *     are sent to poly and back, once as text and once as binary. Commands
+ *     are served from 4 byte reads, and through a writer that throws. A uint8_t
+ *     is called as text both ways, and a cached function calls another cached
+ *     function. Then, on POSIX systems, the same rows are sent as command
+ *     lines to an ibsServer on a Unix domain socket, by a client in this
+ *     program. This needs C++20 and -pthread.
+ */
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include "strinvoke.h"
+using namespace std;
+
+double poly(double x, int n, float k){
+    double r = 0;
+    for (int i = 0; i < n; i ++)
+        r = r * x + k;
+    return r;
+}
+
+uint8_t inc8(uint8_t c){ return c + 1; }
+
+int sq(int x){ return x * x; }
+
+// A cached function that calls another cached function
+int outer(int x){
+    char o[16];
+    string_view args[] = {"sq", "7"};
+    return x + FromChars<int>(string_view(o, ibsCall(args, o, sizeof(o))));
+}
+
+template <typename F>
+double time_ms(F f){
+    auto t0 = chrono::steady_clock::now();
+    f();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+int main(){
+    export_concurrent_function(poly);
+    const size_t rows = 1000000, slot = 32;
+    mt19937 g(2025);
+    vector<string> cells;
+    for (size_t r = 0; r < rows; r ++){
+        cells.push_back(to_string(g() % 1000 / 1000.0));
+        cells.push_back(to_string(g() % 16));
+        cells.push_back(to_string(g() % 100 / 10.0));
+    }
+    vector<string_view> views(cells.begin(), cells.end());
+
+    vector<string> loop(rows);
+    double t_loop = time_ms([&]{
+        for (size_t r = 0; r < rows; r ++)
+            loop[r] = ibsCall("poly", {cells[r * 3], cells[r * 3 + 1], cells[r * 3 + 2]});
+    });
+
+    vector<char> out(rows * slot);
+    vector<size_t> lens(rows);
+    double t_batch = time_ms([&]{
+        ibsBatchCall("poly", ibsBatchArgs(views, 3), out.data(), slot, lens.data());
+    });
+
+    ibsThreadPool pool;
+    double t_pool = time_ms([&]{
+        ibsBatchCall("poly", ibsBatchArgs(views, 3), out.data(), slot, lens.data(), &pool);
+    });
+
+    size_t same = 0;
+    for (size_t r = 0; r < rows; r ++)
+        same += loop[r] == string_view(out.data() + r * slot, lens[r]);
+    cout << "rows:                " << rows << endl;
+    cout << "loop of ibsCall:     " << t_loop << " ms" << endl;
+    cout << "ibsBatchCall:        " << t_batch << " ms" << endl;
+    cout << "ibsBatchCall (" << pool.size() << "T):   " << t_pool << " ms" << endl;
+    cout << "same results:        " << same << endl;
+
+    // Two chained calls, the result of the first one is x of the second
+    const size_t runs = 1000000;
+    double direct = 0, chained = 0, planned = 0;
+    double t_direct = time_ms([&]{
+        for (size_t r = 0; r < runs; r ++)
+            direct += poly(poly(stod(cells[r * 3]), 8, 1.5f), 3, 0.5f);
+    });
+    double t_chained = time_ms([&]{
+        for (size_t r = 0; r < runs; r ++)
+            chained += stod(ibsCall("poly", {ibsCall("poly", {cells[r * 3], "8", "1.5"}), "3", "0.5"}));
+    });
+    ibsPlan plan("a = poly $0 8 1.5\npoly $a 3 0.5");
+    double t_plan = time_ms([&]{
+        for (size_t r = 0; r < runs; r ++){
+            plan.run({views[r * 3]});
+            planned += plan.value<double>();
+        }
+    });
+    cout << "direct calls x2:     " << t_direct << " ms, sum " << direct << endl;
+    cout << "ibsCall x2:          " << t_chained << " ms, sum " << chained << endl;
+    cout << "ibsPlan of 2 steps:  " << t_plan << " ms, sum " << planned << endl;
+
+    // Round trips of typed values, through text and through binary
+    vector<double> xs(runs);
+    vector<int> ns(runs);
+    vector<float> ks(runs);
+    for (size_t r = 0; r < runs; r ++){
+        xs[r] = stod(cells[r * 3]);
+        ns[r] = stoi(cells[r * 3 + 1]);
+        ks[r] = stof(cells[r * 3 + 2]);
+    }
+    ibsHandle h = ibsResolve("poly");
+    double text_sum = 0, binary_sum = 0;
+    double t_text = time_ms([&]{
+        char a[3][32], o[32];
+        for (size_t r = 0; r < runs; r ++){
+            string_view args[] = {
+                string_view(a[0], ToChars(xs[r], a[0], 32)),
+                string_view(a[1], ToChars(ns[r], a[1], 32)),
+                string_view(a[2], ToChars(ks[r], a[2], 32)) };
+            text_sum += FromChars<double>(string_view(o, h(args, o, sizeof(o))));
+        }
+    });
+    double t_binary = time_ms([&]{
+        string a;
+        char o[32];
+        for (size_t r = 0; r < runs; r ++){
+            a.clear();
+            ibsPutBinary(a, xs[r]);
+            ibsPutBinary(a, ns[r]);
+            ibsPutBinary(a, ks[r]);
+            binary_sum += ibsUnpackResult<double>(o, h.binary(a, o, sizeof(o)));
+        }
+    });
+    cout << "text round trips:    " << t_text << " ms, sum " << text_sum << endl;
+    cout << "binary round trips:  " << t_binary << " ms, sum " << binary_sum << endl;
+
+    // Reads shorter than a line must not cut commands
+    {
+        string lines, expected;
+        for (size_t r = 0; r < 1000; r ++){
+            lines += "poly " + cells[r * 3] + ' ' + cells[r * 3 + 1] + ' ' + cells[r * 3 + 2] + '\n';
+            expected += loop[r] + '\n';
+        }
+        ibsServerOptions o;
+        o.read_size = 4;
+        istringstream in(lines);
+        ostringstream results;
+        ibsServer(o).serve(ibsStreamReader(in), ibsStreamWriter(results));
+        cout << "ibsServer 4 byte reads: "
+             << (results.str() == expected ? "same results" : "DIFFERENT results") << endl;
+        istringstream again(lines);
+        string what = "no error";
+        try {
+            ibsServer(o).serve(ibsStreamReader(again),
+                [](const char *, size_t){ throw runtime_error("writer failed"); });
+        }
+        catch (exception &e){
+            what = e.what();
+        }
+        cout << "ibsServer failing writer: " << what << endl;
+    }
+
+    // Character types are chars on both paths, not numbers on one of them
+    {
+        export_function(inc8);
+        bool ok = true;
+        char o[8];
+        for (string_view x: {"A", "65", " z"}){
+            string_view args[] = {"inc8", x};
+            ok &= string_view(o, ibsCall(args, o, sizeof(o))) == ibsCall({"inc8", string(x)});
+        }
+        cout << "uint8_t calls:       " << (ok ? "same results" : "DIFFERENT results") << endl;
+    }
+
+    // The inner cached call must not change the key of the outer one
+    {
+        export_cached_function(sq, 16);
+        export_cached_function(outer, 16);
+        bool ok = true;
+        char o[32];
+        for (string_view x: {"1", "7", "1", "7"}){
+            string_view args[] = {"outer", x};
+            const int want = stoi(string(x)) + 49;
+            ok &= FromChars<int>(string_view(o, ibsCall(args, o, sizeof(o)))) == want;
+            ok &= stoi(ibsCall({"outer", string(x)})) == want;
+        }
+        cout << "nested cached calls: " << (ok ? "same results" : "DIFFERENT results") << endl;
+    }
+
+#ifdef __STR_INVOKE_POSIX__
+    string script;
+    for (size_t r = 0; r < rows; r ++)
+        script += "poly " + cells[r * 3] + ' ' + cells[r * 3 + 1] + ' ' + cells[r * 3 + 2] + '\n';
+    for (size_t workers: {1, 4}){
+        const string path = "/tmp/strinvoke_bench.sock";
+        string results;
+        double t_server = time_ms([&]{
+            ibsServerOptions o;
+            o.workers = workers;
+            thread server([&]{ ibsServeUnix(path, 1, o); });
+            int fd = -1;
+            while (fd < 0)
+                try { fd = ibsConnectUnix(path); } catch (...) { this_thread::yield(); }
+            thread sender([&]{
+                ibsFdWriter(fd)(script.data(), script.size());
+                shutdown(fd, SHUT_WR);
+            });
+            vector<char> buf(1 << 20);
+            auto read = ibsFdReader(fd);
+            for (size_t k; (k = read(buf.data(), buf.size())); )
+                results.append(buf.data(), k);
+            sender.join();
+            server.join();
+            close(fd);
+        });
+        string expected;
+        for (size_t r = 0; r < rows; r ++)
+            expected += loop[r] + '\n';
+        cout << "ibsServer (" << workers << " workers): " << t_server << " ms, "
+             << rows / t_server / 1000 << " M commands/s, "
+             << (results == expected ? "same results" : "DIFFERENT results") << endl;
+    }
+#endif
+    return 0;
+}